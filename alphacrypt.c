@@ -1,5 +1,5 @@
 /*
- * The alphacrypt puzzle, where letters stand for the numbers 1-26 and
+ * The alphacrypt puzzle, where letters stand for the numbers 1-n and
  * the clues are made up of equations.
  *
  * Copyright (C) 2014 Anders Holst (aho@sics.se)
@@ -11,6 +11,17 @@
 #include <assert.h>
 #include <ctype.h>
 #include <math.h>
+#include <limits.h>
+
+/*
+ * Define PARALLEL_GENERATION (and link with pthreads) to let
+ * construct_board try several boards at once on separate threads.
+ */
+#ifdef PARALLEL_GENERATION
+#include <pthread.h>
+#include <unistd.h>
+#define MAX_GENERATION_THREADS 16
+#endif
 
 #include "puzzles.h"
 extern bool midend_undo(midend *me);
@@ -27,6 +38,17 @@ enum {
 
 typedef enum { None, Constant, Plus, Minus, Times, Divide, Square, Sqroot, PythPlus, PythMinus, Modulo, Less, Greater } Operator;
 
+/*
+ * Sets of values 1..MAXSIZE, with bit v-1 for value v. Beyond 26 the
+ * letters are reused with primes, so letter k is written as 'A'+k%26
+ * followed by k/26 apostrophes.
+ */
+#define MAXSIZE 64
+typedef unsigned long long ValueSet;
+#define VBIT(v) ((ValueSet)1 << ((v)-1))
+#define ALLVALUES(n) ((n) >= 64 ? ~(ValueSet)0 : ((ValueSet)1 << (n)) - 1)
+#define MAXSYMLEN (1 + (MAXSIZE-1)/26)
+
 const static int op_nary[] = {0, 0, 2, 2, 2, 2, 1, 1, 2, 2, 2, 1, 1};
 const static int op_det[]  = {0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0};
 
@@ -52,7 +74,7 @@ struct game_state {
     const game_params *par;
     struct clues *clues;
     char *grid;
-    long *pencil;		       /* bitmaps using bits 1<<1..1<<n */
+    ValueSet *pencil;		       /* bitmaps using bits 1<<0..1<<(n-1) */
     int completed, cheated;
 };
 
@@ -232,8 +254,8 @@ static game_params *custom_params(const config_item *cfg)
 
 static const char *validate_params(const game_params *params, bool full)
 {
-    if (params->size < 6 || params->size > 26)
-        return "Game size must be between 6 and 26";
+    if (params->size < 6 || params->size > MAXSIZE)
+        return "Game size must be between 6 and 64";
 /*
     if (params->size == 7 && params->diff > 3)
         return "Game size 7 can not be more difficult than hard";
@@ -255,21 +277,57 @@ typedef struct Equation {
   struct Equation *r1, *r2;
   int nrefs;
   struct Equation** refs;
-  long int poss;
+  ValueSet poss;
   int done;
+  int queued;
 } Equation;
 
 typedef struct EquationBoard {
   const game_params* par;
   int num;
   Equation** eqs;
+  Equation** queue;
+  int qlen;
 } EquationBoard;
 
-const static int sqh[] = {4, 5, 5, 9, 10, 10, 13, 13, 15, 15, 16, 17, 17, 20, 20, 25, 25, 25, 25, 25, 26, 26, -1};
-const static int sql[] = {2, 3, 4, 3,  6,  8,  5, 12,  9, 12,  4,  8, 15, 12, 16,  5,  7, 24, 15, 20, 10, 24, -1};
+const static int sqh[] = {4, 5, 5, 9, 10, 10, 13, 13, 15, 15, 16, 17, 17, 20, 20, 25, 25, 25, 25, 25, 26, 26,
+                          29, 29, 30, 30, 34, 34, 35, 35, 36, 37, 37, 39, 39, 40, 40, 41, 41, 45, 45,
+                          49, 50, 50, 50, 50, 51, 51, 52, 52, 53, 53, 55, 55, 58, 58, 60, 60, 61, 61, 64, -1};
+const static int sql[] = {2, 3, 4, 3,  6,  8,  5, 12,  9, 12,  4,  8, 15, 12, 16,  5,  7, 24, 15, 20, 10, 24,
+                          20, 21, 18, 24, 16, 30, 21, 28,  6, 12, 35, 15, 36, 24, 32,  9, 40, 27, 36,
+                           7, 14, 48, 30, 40, 24, 45, 20, 48, 28, 45, 33, 44, 40, 42, 36, 48, 11, 60,  8, -1};
 
 const static float difflevels[] = {0.0, 0.75, 1.75, 4.0, 12.0};
 
+/* --------- Letters --------- */
+
+static int write_symbol(char* p, int k)
+{
+  /* Write letter k and return its length */
+  int i, len = 1 + k/26;
+  *p++ = 'A' + k%26;
+  for (i=1; i<len; i++)
+    *p++ = '\'';
+  *p = '\0';
+  return len;
+}
+
+static int read_symbol(const char** p, int n)
+{
+  /* Read a letter below n, or return -1 if there is none */
+  const char* q = *p;
+  int k;
+  if (*q < 'A' || *q > 'Z')
+    return -1;
+  k = *q++ - 'A';
+  while (*q == '\'')
+    k += 26, q++;
+  if (k >= n)
+    return -1;
+  *p = q;
+  return k;
+}
+
 /* --------- Create a random board --------- */
 
 
@@ -688,17 +746,70 @@ static int verify_eq1(Operator op, int z, int x)
     return 0;
 }
 
+static int eval_eq2(Operator op, int x, int y)
+{
+  /* The value z determined by x and y, or 0 if there is none */
+  int t;
+  if (op == Plus)
+    return x + y;
+  else if (op == Minus)
+    return x - y;
+  else if (op == Times)
+    return x * y;
+  else if (op == Divide)
+    return (x % y ? 0 : x / y);
+  else if (op == Modulo)
+    return x % y;
+  else if (op == PythPlus || op == PythMinus) {
+    t = (op == PythPlus ? x * x + y * y : x * x - y * y);
+    if (t <= 0) return 0;
+    x = (int)(sqrt(t) + 0.5);
+    return (x * x == t ? x : 0);
+  } else
+    return 0;
+}
+
+/*
+ * The relations for all values up to MAXSIZE, filled in on first use:
+ * eq2_value[op][x][y] is the z with z = x op y (or 0 if there is none
+ * in range), and eq1_values[op][x] the set of z with z op x.
+ */
+static unsigned char eq2_value[Greater+1][MAXSIZE+1][MAXSIZE+1];
+static ValueSet eq1_values[Greater+1][MAXSIZE+1];
+static int relations_ready = 0;
+
+static void init_relations(void)
+{
+  int op, x, y, z;
+  if (relations_ready)
+    return;
+  for (op=Plus; op<=Greater; op++)
+    for (x=1; x<=MAXSIZE; x++) {
+      if (op_nary[op] == 2) {
+        for (y=1; y<=MAXSIZE; y++) {
+          z = eval_eq2(op, x, y);
+          eq2_value[op][x][y] = (z >= 1 && z <= MAXSIZE ? z : 0);
+        }
+      } else if (op_nary[op] == 1) {
+        for (z=1; z<=MAXSIZE; z++)
+          if (verify_eq1(op, z, x))
+            eq1_values[op][x] |= VBIT(z);
+      }
+    }
+  relations_ready = 1;
+}
+
 static int check_subpossible(Equation* eq)
 {
   if (eq->done == 1) {
     if (op_nary[eq->op] == 2) {
       if (eq->r1->done == 1 && eq->r2->done == 1) {
-        return verify_eq2(eq->op, eq->guess, eq->r1->guess, eq->r2->guess);
+        return (eq2_value[eq->op][eq->r1->guess][eq->r2->guess] == eq->guess);
       } else
         return 1;
     } else if (op_nary[eq->op] == 1) {
       if (eq->r1->done == 1) {
-        return verify_eq1(eq->op, eq->guess, eq->r1->guess);
+        return ((eq1_values[eq->op][eq->r1->guess] & VBIT(eq->guess)) != 0);
       } else
         return 1;
     } else
@@ -718,15 +829,16 @@ static int check_possible(Equation* eq)
   return 1;
 }
 
-static int count_internal(EquationBoard* eqb, long int pmask, int lim, int* iter, char* ans)
+static int count_internal(EquationBoard* eqb, ValueSet pmask, int lim, int* iter, int itermax, char* ans)
 {
   Equation* eq = select_equation(eqb);
-  int i, b, n, sum = 0;
+  int i, n, sum = 0;
+  ValueSet b;
   n = eqb->par->size;
   if (!eq) {
     if (ans) {
       for (i=0; i<n; i++) {
-        *ans++ = eqb->eqs[i]->letter;
+        ans += write_symbol(ans, eqb->eqs[i]->letter);
         sprintf(ans, "%d", eqb->eqs[i]->guess);
         ans += strlen(ans);
       }
@@ -738,19 +850,21 @@ static int count_internal(EquationBoard* eqb, long int pmask, int lim, int* iter
   for (i=0, b=1; i<n; i++, b<<=1) {
     eq->guess = i+1;
     if (!(pmask & b) && check_possible(eq)) {
-      sum += count_internal(eqb, pmask | b, lim, iter, ans);
-      if (sum > lim) break;
+      sum += count_internal(eqb, pmask | b, lim, iter, itermax, ans);
+      if (sum > lim || *iter > itermax) break;
     }
   }
   eq->done = 0;
   return sum;
 }
 
-static int count_solutions(EquationBoard* eqb, int lim, float* diff, char* ans)
+static int naive_solutions(EquationBoard* eqb, int lim, float dlim, float* diff)
 {
+  /* The size of this search tree is the difficulty measure. It is cut
+   * short when the difficulty is known to exceed dlim (unless negative). */
   int i, sol, n = eqb->par->size;
   float nn = 0.0;
-  int iter = 0;
+  int iter = 0, itermax;
   for (i=0; i<n; i++)
     if (eqb->eqs[i]->op == Constant) {
       eqb->eqs[i]->guess = eqb->eqs[i]->index;
@@ -763,8 +877,179 @@ static int count_solutions(EquationBoard* eqb, int lim, float* diff, char* ans)
 */
     } else
       eqb->eqs[i]->done = 0;
-  sol = count_internal(eqb, 0, lim, &iter, ans);
-  *diff = (sol == 1 ? (nn > n-2 ? 0.0 : ((float)iter)/((n-nn)*12.0)) : -1.0);
+  itermax = (dlim < 0.0 || nn > n-2 ? INT_MAX : (int)(dlim*(n-nn)*12.0) + 1);
+  sol = count_internal(eqb, 0, lim, &iter, itermax, 0);
+  *diff = (nn > n-2 ? 0.0 : ((float)iter)/((n-nn)*12.0));
+  return sol;
+}
+
+/* --------- Solve by propagation --------- */
+
+/*
+ * Used by solve_game, where the board may come from a typed in game id
+ * and so can be much harder than the generated ones. Each equation keeps
+ * the set of still possible values of its letter in poss, as a bitmask
+ * with bit i for value i+1, and the equations are made arc consistent
+ * before every branch. Generation keeps using count_internal, since its
+ * search tree is the difficulty measure.
+ */
+
+static int bit_count(ValueSet m)
+{
+  int c;
+  for (c=0; m; m &= m-1) c++;
+  return c;
+}
+
+static int narrow_domain(EquationBoard* eqb, Equation* eq, ValueSet mask)
+{
+  /* Restrict the domain of eq, and queue up all equations involving it */
+  int i;
+  ValueSet m;
+  if ((eq->poss & mask) == eq->poss)
+    return 1;
+  eq->poss &= mask;
+  if (!(m = eq->poss))
+    return 0;
+  if (op_nary[eq->op] && !eq->queued)
+    eq->queued = 1, eqb->queue[eqb->qlen++] = eq;
+  for (i=0; i<eq->nrefs; i++)
+    if (!eq->refs[i]->queued)
+      eq->refs[i]->queued = 1, eqb->queue[eqb->qlen++] = eq->refs[i];
+  if (!(m & (m-1))) {
+    /* A single value left, which no other letter can have */
+    for (i=0; i<eqb->num; i++)
+      if (eqb->eqs[i] != eq && !narrow_domain(eqb, eqb->eqs[i], ~m))
+        return 0;
+  }
+  return 1;
+}
+
+static int revise_equation(EquationBoard* eqb, Equation* eq)
+{
+  /* Remove the values without support in the equation */
+  ValueSet sz = 0, sx = 0, sy = 0, mx, my, t;
+  int x, y, z;
+  if (op_nary[eq->op] == 2) {
+    for (mx=eq->r1->poss, x=1; mx; mx>>=1, x++) {
+      if (!(mx & 1)) continue;
+      for (my=eq->r2->poss, y=1; my; my>>=1, y++) {
+        if (!(my & 1)) continue;
+        if (eq->r1 == eq->r2 && x != y) continue;
+        z = eq2_value[eq->op][x][y];
+        if (!z || !(eq->poss & VBIT(z))) continue;
+        if ((eq->r1 == eq && z != x) || (eq->r2 == eq && z != y)) continue;
+        sz |= VBIT(z);
+        sx |= VBIT(x);
+        sy |= VBIT(y);
+      }
+    }
+    return (narrow_domain(eqb, eq, sz) &&
+            narrow_domain(eqb, eq->r1, sx) &&
+            narrow_domain(eqb, eq->r2, sy));
+  } else if (op_nary[eq->op] == 1) {
+    for (mx=eq->r1->poss, x=1; mx; mx>>=1, x++) {
+      if (!(mx & 1)) continue;
+      t = eq1_values[eq->op][x] & eq->poss;
+      if (eq->r1 == eq)
+        t &= VBIT(x);
+      if (t)
+        sz |= t, sx |= VBIT(x);
+    }
+    return (narrow_domain(eqb, eq, sz) &&
+            narrow_domain(eqb, eq->r1, sx));
+  } else
+    return 1;
+}
+
+static int propagate(EquationBoard* eqb)
+{
+  int ok = 1;
+  Equation* eq;
+  while (ok && eqb->qlen) {
+    eq = eqb->queue[--eqb->qlen];
+    eq->queued = 0;
+    ok = revise_equation(eqb, eq);
+  }
+  while (eqb->qlen)
+    eqb->queue[--eqb->qlen]->queued = 0;
+  return ok;
+}
+
+static int solve_propagate(EquationBoard* eqb, ValueSet* stack, char* ans)
+{
+  /* Find a solution, branching on the letter with fewest values left */
+  int i, v, c, best = -1, bc = 0, n = eqb->par->size;
+  ValueSet b, dom;
+  if (!propagate(eqb))
+    return 0;
+  for (i=0; i<n; i++) {
+    c = bit_count(eqb->eqs[i]->poss);
+    if (c > 1 && (best == -1 || c < bc))
+      best = i, bc = c;
+  }
+  if (best == -1) {
+    for (i=0; i<n; i++) {
+      for (v=1; !(eqb->eqs[i]->poss & VBIT(v)); v++);
+      ans += write_symbol(ans, eqb->eqs[i]->letter);
+      sprintf(ans, "%d", v);
+      ans += strlen(ans);
+    }
+    return 1;
+  }
+  for (i=0; i<n; i++)
+    stack[i] = eqb->eqs[i]->poss;
+  dom = stack[best];
+  for (b=1; b && b<=dom; b<<=1) {
+    if (!(dom & b)) continue;
+    for (i=0; i<n; i++)
+      eqb->eqs[i]->poss = stack[i];
+    if (narrow_domain(eqb, eqb->eqs[best], b) &&
+        solve_propagate(eqb, stack + n, ans))
+      return 1;
+  }
+  return 0;
+}
+
+static int solve_by_propagation(EquationBoard* eqb, char* ans)
+{
+  int i, sol, n = eqb->par->size;
+  ValueSet* stack = snewn(n*(n+1), ValueSet);
+  Equation* eq;
+  eqb->queue = snewn(n, Equation*);
+  eqb->qlen = 0;
+  for (i=0; i<n; i++) {
+    eq = eqb->eqs[i];
+    eq->poss = ALLVALUES(n);
+    eq->queued = 1;
+    eqb->queue[eqb->qlen++] = eq;
+  }
+  sol = 1;
+  for (i=0; i<n && sol; i++) {
+    eq = eqb->eqs[i];
+    if (eq->op == Constant)
+      sol = (eq->index >= 1 && eq->index <= n &&
+             narrow_domain(eqb, eq, VBIT(eq->index)));
+  }
+  sol = sol && solve_propagate(eqb, stack, ans);
+  while (eqb->qlen)
+    eqb->queue[--eqb->qlen]->queued = 0;
+  sfree(eqb->queue);
+  sfree(stack);
+  return sol;
+}
+
+static int count_solutions(EquationBoard* eqb, int lim, float dlim, float* diff)
+{
+  /* Number of solutions, and if unique also the difficulty. The search is
+   * cut short at dlim, which screens out the boards that are too hard
+   * (returning 0) without a full enumeration. It lets letters take the
+   * values of constants too, so a single solution there is unique. */
+  int sol = naive_solutions(eqb, lim, dlim, diff);
+  if (dlim >= 0.0 && *diff > dlim)
+    sol = 0;
+  if (sol != 1)
+    *diff = -1.0;
   return sol;
 }
 
@@ -792,7 +1077,7 @@ static float try_prune_equation(Equation* eq, EquationBoard* eqb, float dlim)
     }
   }
 
-  sol = count_solutions(eqb, 1, &diff, 0);
+  sol = count_solutions(eqb, 1, dlim, &diff);
 
   if (sol != 1 || diff > dlim) {
     eq->op = oop;
@@ -814,8 +1099,8 @@ static float try_prune_equation(Equation* eq, EquationBoard* eqb, float dlim)
 
 static void prune_equations(EquationBoard* eqb, random_state* rs, float dlim1, float dlim2, float* diff0, int* feat)
 {
-  long int mask = 0;
-  long int b;
+  ValueSet mask = 0;
+  ValueSet b;
   int i, j, k, n;
   int na, nc, nn, da, dc, dn;
   float diff;
@@ -894,34 +1179,131 @@ static void free_board(EquationBoard* eqb)
   sfree(eqb);
 }
 
-static EquationBoard* construct_board(random_state* rs, const game_params* par, char** aux)
+static EquationBoard* try_board(const game_params* par, random_state* rs, float dmin, float dmax)
 {
-  long int mask = 0;
-  long int b;
-  float diff, dmin, dmax;
-  int i, j, k, n, sol, feat;
-  char* p;
+  /* One attempt at a board within the difficulty limits, or NULL */
+  float diff;
+  int sol, feat;
+  EquationBoard* eqb = randomize_board(par, rs);
+  sol = count_solutions(eqb, 1, dmax, &diff);
+  if (sol == 1) {
+    prune_equations(eqb, rs, dmin, dmax, &diff, &feat);
+    if (feat && diff >= dmin && diff <= dmax)
+      return eqb;
+  }
+  free_board(eqb);
+  return 0;
+}
+
+#ifdef PARALLEL_GENERATION
+
+/*
+ * Attempt number k gets its own random state, seeded from the main one
+ * and k, and the same difficulty window as the k:th serial attempt. The
+ * result is the lowest numbered successful attempt, which makes it
+ * independent of the number of threads and their timing.
+ */
+
+typedef struct ParallelSearch {
+  const game_params* par;
+  char seed[40];
+  pthread_mutex_t lock;
+  int next, best;
+  EquationBoard* found;
+} ParallelSearch;
+
+static void* parallel_worker(void* arg)
+{
+  ParallelSearch* ps = (ParallelSearch*)arg;
+  random_state* rs;
   EquationBoard* eqb;
-  Equation** oldeqs;
-  n = par->size;
-  k = 1;
-  dmin = difflevels[par->diff-1];
-  dmax = difflevels[par->diff];
+  float dmin, dmax;
+  char buf[60];
+  int i, k;
   while (1) {
-    eqb = randomize_board(par, rs);
-    sol = count_solutions(eqb, 1, &diff, 0);
-    if (sol == 1) {
-      prune_equations(eqb, rs, dmin, dmax, &diff, &feat);
-      if (feat && diff >= dmin && diff <= dmax)
-        break;
+    pthread_mutex_lock(&ps->lock);
+    if (ps->best != -1 && ps->next > ps->best) {
+      pthread_mutex_unlock(&ps->lock);
+      break;
     }
-    if (k > 10) {
+    k = ps->next++;
+    pthread_mutex_unlock(&ps->lock);
+    dmin = difflevels[ps->par->diff-1];
+    dmax = difflevels[ps->par->diff];
+    for (i=11; i<k; i++) {
       dmin -= 0.05;
       dmax += 0.05;
     }
-    k += 1;
-    free_board(eqb);
+    sprintf(buf, "%s-%d", ps->seed, k);
+    rs = random_new(buf, strlen(buf));
+    eqb = try_board(ps->par, rs, dmin, dmax);
+    random_free(rs);
+    if (eqb) {
+      pthread_mutex_lock(&ps->lock);
+      if (ps->best == -1 || k < ps->best) {
+        if (ps->found)
+          free_board(ps->found);
+        ps->found = eqb;
+        ps->best = k;
+      } else
+        free_board(eqb);
+      pthread_mutex_unlock(&ps->lock);
+    }
   }
+  return NULL;
+}
+
+static EquationBoard* parallel_construct(random_state* rs, const game_params* par)
+{
+  ParallelSearch ps;
+  pthread_t threads[MAX_GENERATION_THREADS];
+  long nt = sysconf(_SC_NPROCESSORS_ONLN);
+  int i, started;
+  if (nt < 1) nt = 1;
+  if (nt > MAX_GENERATION_THREADS) nt = MAX_GENERATION_THREADS;
+  ps.par = par;
+  sprintf(ps.seed, "%lu", random_bits(rs, 31));
+  pthread_mutex_init(&ps.lock, NULL);
+  ps.next = 1;
+  ps.best = -1;
+  ps.found = 0;
+  for (i=0, started=0; i<nt; i++)
+    if (!pthread_create(&threads[started], NULL, parallel_worker, &ps))
+      started++;
+  if (!started)
+    parallel_worker(&ps);
+  for (i=0; i<started; i++)
+    pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&ps.lock);
+  return ps.found;
+}
+
+#endif /* PARALLEL_GENERATION */
+
+static EquationBoard* construct_board(random_state* rs, const game_params* par, char** aux)
+{
+  ValueSet mask = 0;
+  ValueSet b;
+  int i, j, k, n;
+  char* p;
+  EquationBoard* eqb;
+  Equation** oldeqs;
+  n = par->size;
+  init_relations();
+#ifdef PARALLEL_GENERATION
+  eqb = parallel_construct(rs, par);
+#else
+  {
+    float dmin = difflevels[par->diff-1];
+    float dmax = difflevels[par->diff];
+    for (k=1; !(eqb = try_board(par, rs, dmin, dmax)); k++) {
+      if (k > 10) {
+        dmin -= 0.05;
+        dmax += 0.05;
+      }
+    }
+  }
+#endif
   /* assign letters */
   mask = 0;
   oldeqs = eqb->eqs;
@@ -931,13 +1313,13 @@ static EquationBoard* construct_board(random_state* rs, const game_params* par,
     for (b=1, j=0; (b&mask) || (k>0); j++, k-=(!(b&mask)), b<<=1);
     mask |= b;
     eqb->eqs[n-i] = oldeqs[j];
-    eqb->eqs[n-i]->letter = 'A' + (n-i);
+    eqb->eqs[n-i]->letter = n-i;
   }
   /* fill in answer */
-  *aux = p = snewn(3*n+2, char);
+  *aux = p = snewn((MAXSYMLEN+2)*n+2, char);
   *p++ = 's';
   for (i=0; i<n; i++) {
-    *p++ = eqb->eqs[i]->letter;
+    p += write_symbol(p, eqb->eqs[i]->letter);
     sprintf(p, "%d", eqb->eqs[i]->index);
     p += strlen(p);
   }
@@ -955,23 +1337,23 @@ static char *new_game_desc(const game_params *params, random_state *rs,
     eqb = construct_board(rs, params, aux);
 
     n = params->size;
-    p = buf = snewn(n * 9 + 10, char);
+    p = buf = snewn(n * (6 + 3*MAXSYMLEN) + 10, char);
 
     for (i=0; i<n; i++) {
       eq = eqb->eqs[i];
-      *p++ = eq->letter;
+      p += write_symbol(p, eq->letter);
       if (op_nary[eq->op] == 2) {
         *p++ = '=';
         if (eq->op == PythPlus || eq->op == PythMinus)
           *p++ = 'r', *p++ = 's';
-        *p++ = eq->r1->letter;
+        p += write_symbol(p, eq->r1->letter);
         *p++ = (eq->op == Plus || eq->op == PythPlus ? '+' :
                 eq->op == Minus || eq->op == PythMinus ? '-' :
                 eq->op == Times ? '*' : eq->op == Divide ? '/' :
                 eq->op == Modulo ? '%' : '?');
         if (eq->op == PythPlus || eq->op == PythMinus)
           *p++ = 's';
-        *p++ = eq->r2->letter;
+        p += write_symbol(p, eq->r2->letter);
       } else if (op_nary[eq->op] == 1) {
         if (eq->op == Less)
           *p++ = '<';
@@ -981,7 +1363,7 @@ static char *new_game_desc(const game_params *params, random_state *rs,
           *p++ = '=', *p++ = 's';
         else if (eq->op == Sqroot)
           *p++ = '=', *p++ = 'r';
-        *p++ = eq->r1->letter;
+        p += write_symbol(p, eq->r1->letter);
       } else if (eq->op == Constant) {
         *p++ = '=';
         sprintf(p, "%d", eq->index);
@@ -999,23 +1381,29 @@ static char *new_game_desc(const game_params *params, random_state *rs,
  * Main game UI.
  */
 
+static void board_layout(int n, int* cols, int* rows)
+{
+  *cols = (n > 40 ? 3 : n > 12 ? 2 : 1);
+  *rows = (n + *cols - 1) / *cols;
+}
+
 static const char *validate_desc(const game_params *params, const char *desc)
 {
   int wanted = params->size;
   int n = 0;
 
   while (n < wanted && *desc) {
-    char c = *desc++;
-    if (c < 'A' || c > 'Z')  /* should also check that they are unique... */
+    char c;
+    if (read_symbol(&desc, wanted) < 0)  /* should also check that they are unique... */
       return "Expected letter";
     c = *desc++;
     if (c == '=') {
-      c = *desc++;
+      c = *desc;
       if (c == 'r') {
-        c = *desc++;
+        c = *++desc;
         if (c == 's') {
-          c = *desc++;
-          if (c < 'A' || c > 'Z')
+          desc++;
+          if (read_symbol(&desc, wanted) < 0)
             return "Expected first operand letter";
           c = *desc++;
           if (c != '+' && c != '-')
@@ -1023,33 +1411,30 @@ static const char *validate_desc(const game_params *params, const char *desc)
           c = *desc++;
           if (c != 's')
             return "Expected an 's' before second operand letter";
-          c = *desc++;
-          if (c < 'A' || c > 'Z')
+          if (read_symbol(&desc, wanted) < 0)
             return "Expected second operand letter";
         } else {
-          if (c < 'A' || c > 'Z')
+          if (read_symbol(&desc, wanted) < 0)
             return "Expected operand letter";
         }
       } else if (c == 's') {
-        c = *desc++;
-        if (c < 'A' || c > 'Z')
+        desc++;
+        if (read_symbol(&desc, wanted) < 0)
           return "Expected operand letter";
       } else if (c >= '1' && c <= '9') {
         while (*desc >= '0' && *desc <= '9') desc++;
       } else {
-        if (c < 'A' || c > 'Z')
+        if (read_symbol(&desc, wanted) < 0)
           return "Expected first operand letter";
         c = *desc++;
         if (c != '+' && c != '-' && c != '*' && c != '/' && c != '%')
           return "Expected operator";
-        c = *desc++;
-        if (c < 'A' || c > 'Z')
+        if (read_symbol(&desc, wanted) < 0)
           return "Expected second operand letter";
       }
       c = *desc++;
     } else if (c == '<' || c == '>') {
-      c = *desc++;
-      if (c < 'A' || c > 'Z')
+      if (read_symbol(&desc, wanted) < 0)
         return "Expected operand letter";
       c = *desc++;
     }
@@ -1076,7 +1461,7 @@ static game_state *new_game(midend *me, const game_params *params, const char *d
 
     state->par = params;
     state->grid = snewn(n, char);
-    state->pencil = snewn(n, long);
+    state->pencil = snewn(n, ValueSet);
     for (i=0; i<n; i++) {
         state->grid[i] = -1;
         state->pencil[i] = 0;
@@ -1086,13 +1471,7 @@ static game_state *new_game(midend *me, const game_params *params, const char *d
     state->clues = snew(struct clues);
     state->clues->refcount = 1;
     state->clues->num = n;
-    if (n > 12) {
-      state->clues->cols = 2;
-      state->clues->rows = (n+1)/2;
-    } else {
-      state->clues->cols = 1;
-      state->clues->rows = n;
-    }
+    board_layout(n, &state->clues->cols, &state->clues->rows);
     state->clues->letters = snewn(n, char);
     state->clues->ops = snewn(n, Operator);
     state->clues->l1vec = snewn(n, char);
@@ -1100,51 +1479,51 @@ static game_state *new_game(midend *me, const game_params *params, const char *d
     state->clues->me = me;
 
     for (i=0; i<n; i++) {
-      state->clues->letters[i] = *desc++;
+      state->clues->letters[i] = read_symbol(&desc, n);
       c = *desc++;
       if (c == '=') {
-        c = *desc++;
+        c = *desc;
         if (c == 'r') {
-          c = *desc++;
+          c = *++desc;
           if (c == 's') {
-            c = *desc++;
-            state->clues->l1vec[i] = c;
+            desc++;
+            state->clues->l1vec[i] = read_symbol(&desc, n);
             c = *desc++;
             state->clues->ops[i] = (c == '+' ? PythPlus : PythMinus);
             desc++;
-            state->clues->l2vec[i] = *desc++;
+            state->clues->l2vec[i] = read_symbol(&desc, n);
             desc++;
           } else {
             state->clues->ops[i] = Sqroot;
-            state->clues->l1vec[i] = c;
-            state->clues->l2vec[i] = ' ';
+            state->clues->l1vec[i] = read_symbol(&desc, n);
+            state->clues->l2vec[i] = -1;
             desc++;
           }
         } else if(c == 's') {
+          desc++;
           state->clues->ops[i] = Square;
-          c = *desc++;
-          state->clues->l1vec[i] = c;
-          state->clues->l2vec[i] = ' ';
+          state->clues->l1vec[i] = read_symbol(&desc, n);
+          state->clues->l2vec[i] = -1;
           desc++;
         } else if (c >= '1' && c <= '9') {
-          sscanf(desc-1, "%d", &k);
+          sscanf(desc, "%d", &k);
           state->grid[i] = k;
           state->clues->l1vec[i] = (char)k;
-          state->clues->l2vec[i] = ' ';
+          state->clues->l2vec[i] = -1;
           state->clues->ops[i] = Constant;
           while (*desc >= '0' && *desc <= '9') desc++;
           desc++;
         } else {
-          state->clues->l1vec[i] = c;
+          state->clues->l1vec[i] = read_symbol(&desc, n);
           c = *desc++;
           state->clues->ops[i] = (c == '+' ? Plus : c == '-' ? Minus : c == '*' ? Times : c == '/' ? Divide : c == '%' ? Modulo : None);
-          state->clues->l2vec[i] = *desc++;
+          state->clues->l2vec[i] = read_symbol(&desc, n);
           desc++;
         }
       } else if (c == '<' || c == '>') {
         state->clues->ops[i] = (c == '<' ? Less : Greater);
-        state->clues->l1vec[i] = *desc++;
-        state->clues->l2vec[i] = ' ';
+        state->clues->l1vec[i] = read_symbol(&desc, n);
+        state->clues->l2vec[i] = -1;
         desc++;
       } else {
         state->clues->l1vec[i] = state->clues->l2vec[i] = 0;
@@ -1165,7 +1544,7 @@ static game_state *dup_game(const game_state *state)
     n = state->par->size;
     ret->par = state->par;
     ret->grid = snewn(n, char);
-    ret->pencil = snewn(n, long);
+    ret->pencil = snewn(n, ValueSet);
     for (i=0; i<n; i++) {
         ret->grid[i] = state->grid[i];
         ret->pencil[i] = state->pencil[i];
@@ -1199,12 +1578,13 @@ static char *solve_game(const game_state *state, const game_state *currstate,
   if (aux)
     return dupstr(aux);
   else {
-    EquationBoard *eqb = import_board(state->par, state->clues);
+    EquationBoard *eqb;
     int sol;
-    float diff;
-    char* ans = snewn(3*state->par->size+2, char);
+    char* ans = snewn((MAXSYMLEN+2)*state->par->size+2, char);
     *ans = 's';
-    sol = count_solutions(eqb, 1000, &diff, ans + 1);
+    init_relations();
+    eqb = import_board(state->par, state->clues);
+    sol = solve_by_propagation(eqb, ans + 1);
     free_board(eqb);
     if (sol>0) {
       return ans;
@@ -1320,7 +1700,7 @@ struct game_drawstate {
     int started;
     char *status;
     char *numbers;
-    long *pencils;
+    ValueSet *pencils;
     long *errors;
 };
 
@@ -1343,11 +1723,13 @@ static void finish_pending(const game_ui *ui0)
 static char* make_move_string(const game_params *par, game_ui *ui, struct clues* cl, int n)
 {
   char buf[80];
+  int len;
   if ((n != -1 && 
        (n > par->size || n == 0)))
     return (ui->pending ? dupstr("o") : MOVE_UI_UPDATE);
-  sprintf(buf, "%c%c%d", (char)(ui->hpencil ? 'p' : 'r'),
-          cl->letters[ui->hx*cl->rows + ui->hy], n);
+  buf[0] = (ui->hpencil ? 'p' : 'r');
+  len = 1 + write_symbol(buf+1, cl->letters[ui->hx*cl->rows + ui->hy]);
+  sprintf(buf+len, "%d", n);
   return dupstr(buf);
 }
 
@@ -1480,7 +1862,7 @@ static bool check_errors(const game_state *state, long *errors)
     int num = state->par->size;
     int i, j1, j2;
     int ret = false;
-    long b, mask = 0;
+    ValueSet b, mask = 0;
 
     if (errors)
         for (i=0; i<num; i++) errors[i] = 0;
@@ -1489,7 +1871,7 @@ static bool check_errors(const game_state *state, long *errors)
       if (state->grid[i] == -1) {
         ret = true;
       } else {
-        b = 1L << (state->grid[i] - 1);
+        b = VBIT(state->grid[i]);
         if (mask & b) {
           if (errors) {
             for (j1=0; j1<i && state->grid[j1] != state->grid[i]; j1++);
@@ -1528,21 +1910,21 @@ static game_state *execute_move(const game_state *from0, const char *move)
     game_state* from = (game_state*) from0;
     int num = from->par->size;
     game_state *ret;
-    int i, n;
-    char l;
+    int i, n, l;
+    const char* p;
 
     if (move[0] == 'o') { /* Null operation for delayed moves */
       ret = dup_game(from);
       return ret;
     } else if (move[0] == 's') {
-        const char* p = move + 1;
+        p = move + 1;
 	ret = dup_game(from);
 	ret->completed = ret->cheated = true;
 
         while (*p) {
-          if (sscanf(p, "%c%d", &l, &n) == 2 &&
-              l >= 'A' && l < 'A'+num && n >= -1 && n <= num) {
-            for (p++; *p >= '0' && *p <= '9'; p++);
+          if ((l = read_symbol(&p, num)) >= 0 && sscanf(p, "%d", &n) == 1 &&
+              n >= -1 && n <= num) {
+            for (; *p >= '0' && *p <= '9'; p++);
             for (i=0; i<num && from->clues->letters[i] != l; i++);
             if (i==num) {
               free_game(ret);
@@ -1558,8 +1940,9 @@ static game_state *execute_move(const game_state *from0, const char *move)
 
 	return ret;
     } else if (move[0] == 'p') {
-      if (sscanf(move+1, "%c%d", &l, &n) == 2 &&
-          l >= 'A' && l < 'A'+num && n >= -1 && n <= num) {
+      p = move + 1;
+      if ((l = read_symbol(&p, num)) >= 0 && sscanf(p, "%d", &n) == 1 &&
+          n >= -1 && n <= num) {
         for (i=0; i<num && from->clues->letters[i] != l; i++);
         if (i==num)
           return from;
@@ -1567,13 +1950,14 @@ static game_state *execute_move(const game_state *from0, const char *move)
         if (n == -1)
           ret->pencil[i] = 0;
         else if (n > 0)
-          ret->pencil[i] ^= 1L << (n-1);
+          ret->pencil[i] ^= VBIT(n);
 	return ret;
       } else
         return from;
     } else if (move[0] == 'r') {
-      if (sscanf(move+1, "%c%d", &l, &n) == 2 &&
-          l >= 'A' && l < 'A'+num && n >= -1 && n <= num) {
+      p = move + 1;
+      if ((l = read_symbol(&p, num)) >= 0 && sscanf(p, "%d", &n) == 1 &&
+          n >= -1 && n <= num) {
         for (i=0; i<num && from->clues->letters[i] != l; i++);
         if (i==num)
           return from;
@@ -1594,8 +1978,8 @@ static game_state *execute_move(const game_state *from0, const char *move)
 static void game_compute_size(const game_params *params, int tilesize,
 			      const game_ui *ui, int *x, int *y)
 {
-  int cols = (params->size > 12 ? 2 : 1);
-  int rows = (params->size > 12 ? (params->size+1)/2 : params->size);
+  int cols, rows;
+  board_layout(params->size, &cols, &rows);
   *x = TOTSIZEX(cols, tilesize);
   *y = TOTSIZEY(rows, tilesize);
 }
@@ -1643,13 +2027,12 @@ static game_drawstate *game_new_drawstate(drawing *dr, const game_state *state)
     int n = state->par->size;
 
     ds->tilesize = 0;
-    ds->w = (n > 12 ? 2 : 1);
-    ds->h = (n > 12 ? (n+1)/2 : n);
+    board_layout(n, &ds->w, &ds->h);
     a = ds->w*ds->h;
     ds->started = false;
     ds->status = snewn(a, char);
     ds->numbers = snewn(a, char);
-    ds->pencils = snewn(a, long);
+    ds->pencils = snewn(a, ValueSet);
     ds->errors = snewn(a, long);
     for (i=0; i<a; i++)
       ds->status[i] = -1, ds->numbers[i] = 0, ds->pencils[i] = 0, ds->errors[i] = 0;
@@ -1667,7 +2050,7 @@ static void game_free_drawstate(drawing *dr, game_drawstate *ds)
 }
 
 static void draw_tile(drawing *dr, game_drawstate *ds, const game_params *par,
-		      struct clues *clues, int x, int y, char status, char number, long pencil)
+		      struct clues *clues, int x, int y, char status, char number, ValueSet pencil)
 {
     int tx, ty, tw, th;
     int cx, cy, cw, ch;
@@ -1700,7 +2083,7 @@ static void draw_tile(drawing *dr, game_drawstate *ds, const game_params *par,
     }
     if (y + x*clues->rows <= clues->num) { /* Equation square */
       Operator op = clues->ops[y + x*clues->rows];
-      sprintf(str, "%c", clues->letters[y + x*clues->rows]);
+      write_symbol(str, clues->letters[y + x*clues->rows]);
       draw_text(dr, tx + SUBTILESIZEX(ds->tilesize)/2, ty + TILESIZEY(ds->tilesize)/2,
                 FONT_VARIABLE, TILESIZEY(ds->tilesize)*2/5, ALIGN_VCENTRE | ALIGN_HCENTRE,
                 COL_GRID, str);
@@ -1714,7 +2097,7 @@ static void draw_tile(drawing *dr, game_drawstate *ds, const game_params *par,
         draw_text(dr, tx + SUBTILESIZEX(ds->tilesize)*27/12, ty + TILESIZEY(ds->tilesize)/2,
                   FONT_VARIABLE, TILESIZEY(ds->tilesize)*2/5, ALIGN_VCENTRE | ALIGN_HCENTRE,
                   (status & DF_ERR_EQUATION ? COL_ERROR : COL_GRID), str);
-        sprintf(str, "%c", clues->l1vec[y + x*clues->rows]);
+        write_symbol(str, clues->l1vec[y + x*clues->rows]);
         draw_text(dr, tx + SUBTILESIZEX(ds->tilesize)*33/12, ty + TILESIZEY(ds->tilesize)/2,
                   FONT_VARIABLE, TILESIZEY(ds->tilesize)*2/5, ALIGN_VCENTRE | ALIGN_HCENTRE,
                   (status & DF_ERR_EQUATION ? COL_ERROR : COL_GRID), str);
@@ -1722,7 +2105,7 @@ static void draw_tile(drawing *dr, game_drawstate *ds, const game_params *par,
         draw_text(dr, tx + SUBTILESIZEX(ds->tilesize)*39/12, ty + TILESIZEY(ds->tilesize)/2,
                   FONT_VARIABLE, TILESIZEY(ds->tilesize)*2/5, ALIGN_VCENTRE | ALIGN_HCENTRE,
                   (status & DF_ERR_EQUATION ? COL_ERROR : COL_GRID), str);
-        sprintf(str, "%c", clues->l2vec[y + x*clues->rows]);
+        write_symbol(str, clues->l2vec[y + x*clues->rows]);
         draw_text(dr, tx + SUBTILESIZEX(ds->tilesize)*(pyth ? 43 : 45)/12, ty + TILESIZEY(ds->tilesize)/2,
                   FONT_VARIABLE, TILESIZEY(ds->tilesize)*2/5, ALIGN_VCENTRE | ALIGN_HCENTRE,
                   (status & DF_ERR_EQUATION ? COL_ERROR : COL_GRID), str);
@@ -1749,7 +2132,7 @@ static void draw_tile(drawing *dr, game_drawstate *ds, const game_params *par,
         draw_text(dr, tx + SUBTILESIZEX(ds->tilesize)*27/12, ty + TILESIZEY(ds->tilesize)/2,
                   FONT_VARIABLE, TILESIZEY(ds->tilesize)*2/5, ALIGN_VCENTRE | ALIGN_HCENTRE,
                   (status & DF_ERR_EQUATION ? COL_ERROR : COL_GRID), str);
-        sprintf(str, "%c", clues->l1vec[y + x*clues->rows]);
+        write_symbol(str, clues->l1vec[y + x*clues->rows]);
         draw_text(dr, tx + SUBTILESIZEX(ds->tilesize)*33/12, ty + TILESIZEY(ds->tilesize)/2,
                   FONT_VARIABLE, TILESIZEY(ds->tilesize)*2/5, ALIGN_VCENTRE | ALIGN_HCENTRE,
                   (status & DF_ERR_EQUATION ? COL_ERROR : COL_GRID), str);
@@ -1781,7 +2164,7 @@ static void draw_tile(drawing *dr, game_drawstate *ds, const game_params *par,
                   FONT_VARIABLE, TILESIZEY(ds->tilesize)/2, ALIGN_VCENTRE | ALIGN_HCENTRE,
                   COL_USER, str);
       } else {
-            long rev;
+            ValueSet rev;
             int i, j, npencil;
             int pl, pr, pt, pb;
             float vhprop;
@@ -1789,11 +2172,11 @@ static void draw_tile(drawing *dr, game_drawstate *ds, const game_params *par,
 
             /* Count the pencil marks required. */
             if (number) {
-              npencil = 1, rev = 1L << (number-1);
+              npencil = 1, rev = VBIT(number);
             } else
               npencil = 0, rev = 0;
             for (i = 1; i <= par->size; i++)
-              if ((pencil ^ rev) & (1L << (i-1)))
+              if ((pencil ^ rev) & VBIT(i))
                 npencil++;
             if (npencil) {
                 minph = 2;
@@ -1835,7 +2218,7 @@ static void draw_tile(drawing *dr, game_drawstate *ds, const game_params *par,
                  * Now actually draw the pencil marks.
                  */
                 for (i = 1, j = 0; i <= par->size; i++)
-                  if ((pencil ^ rev) & (1L << (i-1))) {
+                  if ((pencil ^ rev) & VBIT(i)) {
                     int dx = j % pw, dy = j / pw;
                     sprintf(str, "%d", i);
                     draw_text(dr, pl + pgsizex * (2*dx+1) / 2,
@@ -1908,7 +2291,7 @@ static void game_redraw(drawing *dr, game_drawstate *ds, const game_state *oldst
       for (y=0; y<rows; y++, i++) {
         char status = 0;
         char number;
-        long pencil;
+        ValueSet pencil;
         
         if (i<n) {
           pencil = state->pencil[i];
@@ -33,6 +33,12 @@ enum {
 int primes[] = {0, 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47};
 float logprimes[] = {-1, 0.69314718, 1.98612289, 1.60943791, 1.94591015, 2.39789527, 2.56494936, 2.83321334, 2.94443898, 3.13549422, 3.36729583, 3.43398720, 3.61091791, 3.71357207, 3.76120012, 3.85014760};
 
+/* Table of (k+0.5)*log(k), the k-dependent part of Stirling's formula
+ * for log(k!), from which the log-binomials in the estimate are made */
+#define LOGTAB_SIZE 128
+static double logfact_tab[LOGTAB_SIZE];
+static int logfact_init = 0;
+
 #define BAD_GEN_LIMIT(size) (size >= 12 ? 2000 : 1000)
 #define ITER_LIMIT(size) (size >= 12 ? 8000 : 5000)
 
@@ -284,8 +290,17 @@ typedef struct Run {
     int dir; /* 0 vertical, 1 horizontal */
     int srem;
     int done;
+    int changed;
 } Run;
 
+typedef struct EstCache {
+    int gen;      /* count_solutions call in which the entry was last seen */
+    int nslots;
+    long xmask;   /* which slots have a crossing run */
+    char n[NPRIME];
+    float est;
+} EstCache;
+
 typedef struct FactorBoard {
     const game_params *par;
     Slot **slots;
@@ -298,6 +313,8 @@ typedef struct FactorBoard {
     long onesol;
     int estimate;
     float estlimit;
+    EstCache *estcache; /* per run start and direction */
+    int estgen;
 } FactorBoard;
 
 static void clean(FactorBoard *fb);
@@ -379,6 +396,7 @@ static Run *new_Run(int ns, int d, char *nn)
     for (i=0; i<NPRIME; i++)
         r->r[i] = r->n[i] = nn[i];
     r->done = 0;
+    r->changed = 1;
     r->slots = snewn(ns, Slot *);
     for (i=0; i<ns; i++)
         r->slots[i] = 0;
@@ -515,6 +533,7 @@ static void unfix(Run *r)
 
 static FactorBoard *new_FactorBoard(const game_params* p)
 {
+    int i;
     FactorBoard *fb = snew(FactorBoard);
     fb->par = p;
     fb->slots = 0;
@@ -526,6 +545,16 @@ static FactorBoard *new_FactorBoard(const game_params* p)
     fb->quickret = 0;
     fb->estimate = 0;
     fb->onesol = 0;
+    fb->estcache = snewn(2*p->size*p->size, EstCache);
+    for (i=0; i<2*p->size*p->size; i++)
+        fb->estcache[i].gen = -1;
+    fb->estgen = 0;
+    if (!logfact_init) {
+        logfact_tab[0] = 0.0;
+        for (i=1; i<LOGTAB_SIZE; i++)
+            logfact_tab[i] = (i+0.5)*log(i);
+        logfact_init = 1;
+    }
     return fb;
 }
 
@@ -534,6 +563,7 @@ static void delete_FactorBoard(FactorBoard *fb)
     clean(fb);
     if (fb->candidate)
         sfree(fb->candidate);
+    sfree(fb->estcache);
     sfree(fb);
 }
 
@@ -883,6 +913,17 @@ static long count_possibilities(const game_params* par, Run* run, long limit)
   return count;
 }
   
+static double logfact(int k)
+{
+  return (k < LOGTAB_SIZE ? logfact_tab[k] : (k+0.5)*log(k));
+}
+
+static double log_binomial(int n, int k)
+{
+  /* Stirling approximation of log(n over k), as a rough measure */
+  return logfact(n) - logfact(k) - logfact(n-k) - 1;
+}
+
 float estimate_possibilities(const game_params* par, Run* run)
 {
   /* Rough estimate of possible placements of factors */
@@ -901,15 +942,64 @@ float estimate_possibilities(const game_params* par, Run* run)
     bn += n*logprimes[j];
     if (j <= (par->pmax+1)/2) {
       if (m > 1)
-        lp += (m+n-0.5)*log(m+n-1) - (n+0.5)*log(n) - (m-0.5)*log(m-1) - 1;
+        lp += log_binomial(m+n-1, n);
     } else {
       if (m > n)
-        lp += (m+0.5)*log(m) - (n+0.5)*log(n) - (m-n+0.5)*log(m-n) - 1;
+        lp += log_binomial(m, n);
     }
   }
   return (lp + (bn>20 ? (bn-20) : 0.0));
 }
 
+static EstCache *estcache_entry(FactorBoard *fb, Run *run)
+{
+  return &fb->estcache[2*(run->slots[0]->x + run->slots[0]->y*fb->par->size) + run->dir];
+}
+
+static void estcache_update(FactorBoard *fb)
+{
+  /* Compare each run with what was at the same place in the previous
+   * call, to find out which clues changed by the last mutation */
+  int i, j;
+  long xmask;
+  EstCache *ec;
+  Run *r;
+  fb->estgen++;
+  for (i=0; i<fb->nruns; i++) {
+    r = fb->runs[i];
+    ec = estcache_entry(fb, r);
+    for (j=0, xmask=0; j<r->nslots; j++)
+      if (r->slots[j]->run[1-r->dir])
+        xmask |= 1L << j;
+    r->changed = (ec->gen != fb->estgen-1 || ec->nslots != r->nslots ||
+                  ec->xmask != xmask || memcmp(ec->n, r->n, NPRIME));
+    if (r->changed) {
+      ec->nslots = r->nslots;
+      ec->xmask = xmask;
+      memcpy(ec->n, r->n, NPRIME);
+    }
+    ec->gen = fb->estgen;
+  }
+}
+
+static float cached_estimate(FactorBoard *fb, Run *run)
+{
+  /* The estimate depends on the run's own clue and those of the
+   * crossing runs, so it is only recalculated if any of them changed.
+   * Only valid when no run is fixed yet. */
+  int i, dirty = run->changed;
+  Run *r0;
+  EstCache *ec = estcache_entry(fb, run);
+  for (i=0; i<run->nslots && !dirty; i++) {
+    r0 = run->slots[i]->run[1-run->dir];
+    if (r0 && r0->changed)
+      dirty = 1;
+  }
+  if (dirty)
+    ec->est = estimate_possibilities(fb->par, run);
+  return ec->est;
+}
+
 static Run *select_run(FactorBoard *fb)
 {
     int i, best = -1;
@@ -1017,9 +1107,10 @@ static void count_solutions(FactorBoard *fb, const char *str, long limit, long *
       *sol = -1;
     } else if (fb->estimate) {
       ok = 1;
+      estcache_update(fb);
       for (i=0; i<fb->nruns; i++)
         if (!fb->runs[i]->n[0]) {
-          lp += estimate_possibilities(fb->par, fb->runs[i]);
+          lp += cached_estimate(fb, fb->runs[i]);
           if (too_big(fb->par, fb->runs[i])) ok = 0;
         }
       if (lp < fb->estlimit && lp*100 + fb->itermax < limit && ok) {
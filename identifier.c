@@ -51,8 +51,8 @@ allowed.
 Finally you can specify the shape configuration, in terms of how many copies
 of each shape and of which level, i.e how many black squares they consist of.
 For example "2*6,3*4" means 2 copies of a shape of 6 squares and 3 copies of
-a shape of 4 squares. Maximum shape size is 12 (for which it takes several
-minutes to compile the dictionary of all shapes).
+a shape of 4 squares. Maximum shape size is 12 (for which it takes a few
+seconds to compile the dictionary of all shapes).
 
 Controls:
 
@@ -138,12 +138,32 @@ Good luck!
 */
 
 
+#ifdef PARALLEL_GENERATION
+#define _POSIX_C_SOURCE 200809L /* For clock_gettime(), also with -std=c99 */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <ctype.h>
 #include <math.h>
+#include <limits.h>
+#include <time.h>
+
+/*
+ * Define PARALLEL_GENERATION (and link with pthreads) to let the entropy
+ * search run its top level branches on separate threads, and to let the
+ * computer in Duel mode work on its next guess during the human's turn.
+ */
+#ifdef PARALLEL_GENERATION
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#define MAX_GENERATION_THREADS 16
+#define COMPUTER_GUESS_DEADLINE 10 /* Seconds to wait for a guess */
+#define COMPUTER_GUESS_SAMPLE_TIME 1.0 /* Seconds of sampling after that */
+#endif
 
 #include "puzzles.h"
 
@@ -180,6 +200,8 @@ static int imin(int a, int b) { return (a<b ? a : b); };
 typedef struct Shape {
   int width, height;
   char* pix;
+  unsigned short* rows; /* Pre-rendered orientations of dictionary shapes */
+  short rowind[8];
 } Shape;
 
 int ShapeWidth(Shape* sh, int reflbit)
@@ -208,6 +230,15 @@ void SetShapePix(Shape* sh, int x, int y, int reflbit, char val)
     sh->pix[(60&reflbit ? sh->width-x : x+1)+(240&reflbit ? sh->height-y : y+1)*(sh->width+2)] = val;
 };
 
+const unsigned short* ShapeRows(Shape* sh, int reflbit)
+{
+  /* ON row masks of the padded shape in orientation reflbit, followed by
+     its OFF row masks. Bit i of a row is the padded column i. */
+  int i;
+  for (i=0; !(reflbit & (1<<i)); i++);
+  return sh->rows + sh->rowind[i];
+}
+
 typedef struct ShapeConfig {
   int numcomp;
   int symmetry;
@@ -225,13 +256,19 @@ typedef struct ShapeAnswer {
   int** shapeb;
 } ShapeAnswer;
 
+typedef struct ShapePlace {
+  int smask;    /* Orientations to place, up to the symmetry of the shape */
+  int nr1, nr2; /* How many of them keep or swap the width and height */
+} ShapePlace;
+
 typedef struct ShapeDict {
   int maxlevel;
   int toplevel;
   int totnum;
   int reflmask;
   int* len;
-  Shape*** shapes;
+  Shape** shapes;     /* One block of shapes per level */
+  ShapePlace** place; /* And of their placement classes */
 } ShapeDict;
 
 int ShapeDictNum(ShapeDict* sd, int lev)
@@ -241,7 +278,7 @@ int ShapeDictNum(ShapeDict* sd, int lev)
 
 Shape* ShapeDictGet(ShapeDict* sd, int lev, int ind)
 {
-  return sd->shapes[lev-1][ind];
+  return &sd->shapes[lev-1][ind];
 }
 
 typedef struct DictStatistics {
@@ -251,12 +288,14 @@ typedef struct DictStatistics {
   int num; /* Total number of shapes in all comp levels */
   int bsize;
   Shape* board;
-  int* lenposs;
-  int* numposs;
-  int* smask;
-  int* np1;
+  int* lenposs;    /* These four per shape are fixed, and a copy shares */
+  int* smask;      /* them with the statistics it was made from, which */
+  int* np1;        /* must outlive it */
   int* np2;
-  char** poss;
+  int copied;
+  int* numposs;
+  char** poss;     /* Per shape, into one block of totposs */
+  int totposs;
   double* entr;
 } DictStatistics;
 
@@ -274,12 +313,17 @@ typedef struct DictHyperIndex {
   int* xvec;
   int* yvec;
   int* bvec;
+  int* basenumposs; /* Possibilities of the other components on origboard */
+  int* undo;        /* Pairs of shape and placement cleared since then */
+  int nundo, undosize;
+  int* ind;
 } DictHyperIndex;
 
 Shape* make_unit_shape()
 {
   Shape* shape = snew(Shape);
   shape->width = shape->height = 1;
+  shape->rows = 0;
   shape->pix = snewn(9, char);
   for (int i=0; i<9; i++)
     shape->pix[i] = (i==4 ? ID_ON : ID_OFF);
@@ -291,6 +335,7 @@ Shape* make_empty_board(int w, int h)
   Shape* shape = snew(Shape);
   shape->width = w;
   shape->height = h;
+  shape->rows = 0;
   shape->pix = snewn((w+2)*(h+2), char);
   for (int i=0; i<(w+2)*(h+2); i++)
     shape->pix[i] = ID_UNKNOWN;
@@ -308,6 +353,7 @@ Shape* make_incr_shape(Shape* initial, int addx, int addy)
   else
     shape->width = initial->width, shape->height = initial->height;
   npix = (shape->width+2) * (shape->height+2);
+  shape->rows = 0;
   shape->pix = snewn(npix, char);
   for (int i=0, j=0; j<npix; j++)
     if (addx == -1 ? j%(shape->width+2)==0 :
@@ -341,6 +387,8 @@ int can_incr_shape(Shape* initial, int addx, int addy)
 
 void free_shape(Shape* shape)
 {
+  if (shape->rows)
+    sfree(shape->rows);
   sfree(shape->pix);
   sfree(shape);
 }
@@ -377,12 +425,43 @@ Shape* copy_shape(Shape* shape)
   int n = (shape->width + 2) * (shape->height + 2);
   ret->width = shape->width;
   ret->height = shape->height;
+  ret->rows = 0;
   ret->pix = snewn(n, char);
   for (int i=0; i<n; i++)
     ret->pix[i] = shape->pix[i];
   return ret;
 }
 
+int render_shape_rows(Shape* shape, int reflmask)
+{
+  /* Render the orientations in reflmask as row bitmasks into shape->rows,
+     for the placement tests below, or only count the rows if that is 0.
+     Shapes are at most 12 wide, so a padded row fits 16 bits. */
+  int n = 0;
+  for (int b=1, i=0; i<8; i++, b<<=1)
+    if (reflmask&b) {
+      shape->rowind[i] = n;
+      n += 2*(ShapeHeight(shape, b)+2);
+    } else
+      shape->rowind[i] = -1;
+  if (!shape->rows)
+    return n;
+  for (int b=1, i=0; i<8; i++, b<<=1)
+    if (reflmask&b) {
+      int sh = ShapeHeight(shape, b)+2;
+      unsigned short* son = shape->rows + shape->rowind[i];
+      for (int yy=-1; yy<=ShapeHeight(shape, b); yy++) {
+        son[yy+1] = son[sh+yy+1] = 0;
+        for (int xx=-1; xx<=ShapeWidth(shape, b); xx++)
+          if (ShapePix(shape, xx, yy, b) == ID_ON)
+            son[yy+1] |= 1 << (xx+1);
+          else if (ShapePix(shape, xx, yy, b) == ID_OFF)
+            son[sh+yy+1] |= 1 << (xx+1);
+      }
+    }
+  return n;
+}
+
 int same_shape(Shape* sh1, Shape* sh2, int reflmask)
 {
   int smask = 0;
@@ -406,77 +485,6 @@ int same_shape(Shape* sh1, Shape* sh2, int reflmask)
   return 0;
 }
 
-ShapeDict* init_shape_dictionary(int maxlev, int reflmask)
-{
-  ShapeDict* dict = snew(ShapeDict);
-  dict->maxlevel = maxlev;
-  dict->toplevel = 1;
-  dict->reflmask = reflmask;
-  dict->len = snewn(maxlev, int);
-  dict->shapes = snewn(maxlev, Shape**);
-  dict->shapes[0] = snewn(1, Shape*);
-  dict->shapes[0][0] = make_unit_shape();
-  dict->len[0] = 1;
-  dict->totnum = 1;
-  return dict;
-}
-
-void extend_shape_dictionary(ShapeDict* dict, int lev)
-{
-  int worksize = 1000;
-  int nr, newsize, i, j, k, x, y;
-  Shape** work = snewn(worksize, Shape*);
-  Shape** newwork;
-  Shape* shape;
-  for (i=dict->toplevel; i<lev; i++) {
-    nr = 0;
-    for (j=0; j<dict->len[i-1]; j++)
-      for (x=-1; x<=dict->shapes[i-1][j]->width; x++)
-        for (y=-1; y<=dict->shapes[i-1][j]->height; y++)
-          if (can_incr_shape(dict->shapes[i-1][j], x, y)) {
-            shape = make_incr_shape(dict->shapes[i-1][j], x, y);
-            for (k=0; k<nr; k++)
-              if (same_shape(work[k], shape, dict->reflmask))
-                break;
-            if (k<nr) {
-              free_shape(shape);
-              continue;
-            } else {
-              if (nr == worksize) {
-                newsize = 2*worksize;
-                newwork = snewn(newsize, Shape*);
-                for (k=0; k<worksize; k++)
-                  newwork[k] = work[k];
-                sfree(work);
-                work = newwork;
-                worksize = newsize;
-              }
-              work[nr++] = shape;
-            }
-          }
-    dict->shapes[i] = snewn(nr, Shape*);
-    for (k=0; k<nr; k++)
-      dict->shapes[i][k] = work[k];
-    dict->len[i] = nr;
-    dict->totnum += nr;
-  }
-  dict->toplevel = lev;
-  sfree(work);
-}
-
-void free_shape_dictionary(ShapeDict* dict)
-{
-  int i, j;
-  for (i=0; i<dict->maxlevel; i++) {
-    for (j=0; j<dict->len[i]; j++)
-      free_shape(dict->shapes[i][j]);
-    sfree(dict->shapes[i]);
-  }
-  sfree(dict->shapes);
-  sfree(dict->len);
-  sfree(dict);
-}
-
 /*
 Symmetry relations used below
 
@@ -509,12 +517,12 @@ C: B B B B    10010000 =9    10000000 =1    11000000 =3
 
  */
 
-void calc_needed_positions(Shape* shape, Shape* board, int reflmask, int* smask, int* nr1, int* nr2, int* np1, int* np2)
+void calc_shape_place(Shape* shape, int reflmask, ShapePlace* pl)
 {
   /* Find the symmetry class of the shape */
   int s1=0, s2=0;
   if (reflmask==ID_REFL_ORIG)
-    *smask = 1, *nr1 = 1, *nr2 = 0;
+    pl->smask = 1, pl->nr1 = 1, pl->nr2 = 0;
   else {
     if (same_shape(shape, shape, 128)) s1++;
     if (same_shape(shape, shape, 8)) s1++;
@@ -522,207 +530,657 @@ void calc_needed_positions(Shape* shape, Shape* board, int reflmask, int* smask,
     if (same_shape(shape, shape, 2)) s2++;
     if (s1+s2) {
       if (s1+s2 == 4)
-        *smask = 1, *nr1 = 1, *nr2 = 0;
+        pl->smask = 1, pl->nr1 = 1, pl->nr2 = 0;
       else if (s1) {
         if (s1 == 2)
           if (reflmask == ID_REFL_MIR)
-            *smask = 1, *nr1 = 1, *nr2 = 0;
+            pl->smask = 1, pl->nr1 = 1, pl->nr2 = 0;
           else
-            *smask = 5, *nr1 = 1, *nr2 = 1;
+            pl->smask = 5, pl->nr1 = 1, pl->nr2 = 1;
         else
           if (reflmask == ID_REFL_MIR)
-            *smask = 17, *nr1 = 2, *nr2 = 0;
+            pl->smask = 17, pl->nr1 = 2, pl->nr2 = 0;
           else
-            *smask = 85, *nr1 = 2, *nr2 = 2;
+            pl->smask = 85, pl->nr1 = 2, pl->nr2 = 2;
       } else {
         if (s2 == 2)
           if (reflmask == ID_REFL_ROT)
-            *smask = 5, *nr1 = 1, *nr2 = 1;
+            pl->smask = 5, pl->nr1 = 1, pl->nr2 = 1;
           else
-            *smask = 9, *nr1 = 2, *nr2 = 0;
+            pl->smask = 9, pl->nr1 = 2, pl->nr2 = 0;
         else
           if (reflmask == ID_REFL_ROT)
-            *smask = 85, *nr1 = 2, *nr2 = 2;
+            pl->smask = 85, pl->nr1 = 2, pl->nr2 = 2;
           else
-            *smask = 153, *nr1 = 4, *nr2 = 0;
+            pl->smask = 153, pl->nr1 = 4, pl->nr2 = 0;
       }
     } else if (same_shape(shape, shape, 4)) {
       if (reflmask == ID_REFL_MIR)
-        *smask = 9, *nr1 = 2, *nr2 = 0;
+        pl->smask = 9, pl->nr1 = 2, pl->nr2 = 0;
       else if (reflmask == ID_REFL_ROT)
-        *smask = 1, *nr1 = 1, *nr2 = 0;
+        pl->smask = 1, pl->nr1 = 1, pl->nr2 = 0;
       else
-        *smask = 9, *nr1 = 2, *nr2 = 0;
+        pl->smask = 9, pl->nr1 = 2, pl->nr2 = 0;
     } else if (same_shape(shape, shape, 16)) {
       if (reflmask == ID_REFL_MIR)
-        *smask = 9, *nr1 = 2, *nr2 = 0;
+        pl->smask = 9, pl->nr1 = 2, pl->nr2 = 0;
       else if (reflmask == ID_REFL_ROT)
-        *smask = 5, *nr1 = 1, *nr2 = 1;
+        pl->smask = 5, pl->nr1 = 1, pl->nr2 = 1;
       else
-        *smask = 15, *nr1 = 2, *nr2 = 2;
+        pl->smask = 15, pl->nr1 = 2, pl->nr2 = 2;
     } else {
-      *smask = reflmask;
+      pl->smask = reflmask;
       if (reflmask == ID_REFL_MIR)
-        *nr1 = 4, *nr2 = 0;
+        pl->nr1 = 4, pl->nr2 = 0;
       else if (reflmask == ID_REFL_ROT)
-        *nr1 = 2, *nr2 = 2;
+        pl->nr1 = 2, pl->nr2 = 2;
       else
-        *nr1 = 4, *nr2 = 4;
+        pl->nr1 = 4, pl->nr2 = 4;
     }
   }
+}
+
+void store_shape_level(ShapeDict* dict, int lev, Shape** work, int nr)
+{
+  /* Move the shapes of a level into one block of shapes, one of pixels and
+     one of row masks, instead of keeping an allocation per shape. The first
+     shape of the level points to the start of the other two blocks. Their
+     placement classes are worked out here once, for every board. */
+  int npix = 0, nrows = 0;
+  Shape* block = snewn(nr, Shape);
+  ShapePlace* place = snewn(nr, ShapePlace);
+  char* pix;
+  unsigned short* rows;
+  for (int k=0; k<nr; k++) {
+    npix += (work[k]->width+2)*(work[k]->height+2);
+    nrows += render_shape_rows(work[k], dict->reflmask);
+  }
+  pix = snewn(npix, char);
+  rows = snewn(nrows, unsigned short);
+  for (int k=0; k<nr; k++) {
+    int n = (work[k]->width+2)*(work[k]->height+2);
+    block[k].width = work[k]->width;
+    block[k].height = work[k]->height;
+    block[k].pix = pix;
+    for (int i=0; i<n; i++)
+      pix[i] = work[k]->pix[i];
+    pix += n;
+    block[k].rows = rows;
+    rows += render_shape_rows(&block[k], dict->reflmask);
+    calc_shape_place(&block[k], dict->reflmask, &place[k]);
+    free_shape(work[k]);
+  }
+  dict->shapes[lev-1] = block;
+  dict->place[lev-1] = place;
+  dict->len[lev-1] = nr;
+}
+
+ShapeDict* init_shape_dictionary(int maxlev, int reflmask)
+{
+  ShapeDict* dict = snew(ShapeDict);
+  Shape* unit = make_unit_shape();
+  dict->maxlevel = maxlev;
+  dict->toplevel = 1;
+  dict->reflmask = reflmask;
+  dict->len = snewn(maxlev, int);
+  dict->shapes = snewn(maxlev, Shape*);
+  dict->place = snewn(maxlev, ShapePlace*);
+  store_shape_level(dict, 1, &unit, 1);
+  dict->totnum = 1;
+  return dict;
+}
+
+unsigned long long shape_key(Shape* shape, int reflmask)
+{
+  /* Canonical key of a shape: the least encoding among its orientations in
+     reflmask, with one bit per square row by row below the width and height.
+     A shape of at most 12 squares has a bounding box of at most 42 squares. */
+  unsigned long long key, best = 0;
+  for (int b=1, i=0; i<8; i++, b<<=1)
+    if (reflmask&b) {
+      key = 0;
+      for (int y=0; y<ShapeHeight(shape, b); y++)
+        for (int x=0; x<ShapeWidth(shape, b); x++)
+          key = (key << 1) | (ShapePix(shape, x, y, b) == ID_ON);
+      key |= (unsigned long long)ShapeWidth(shape, b) << 56 | (unsigned long long)ShapeHeight(shape, b) << 60;
+      if (!best || key < best)
+        best = key;
+    }
+  return best;
+}
+
+int insert_shape_key(unsigned long long* table, int size, unsigned long long key)
+{
+  /* Open addressing in a table of power of two size, where 0 is empty.
+     Returns 0 if the key was already there. */
+  int i = (int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (size-1);
+  while (table[i]) {
+    if (table[i] == key)
+      return 0;
+    i = (i+1) & (size-1);
+  }
+  table[i] = key;
+  return 1;
+}
+
+void extend_shape_dictionary(ShapeDict* dict, int lev)
+{
+  int worksize = 1000, hashsize = 2048;
+  int nr, newsize, i, j, k, x, y;
+  Shape** work = snewn(worksize, Shape*);
+  Shape** newwork;
+  unsigned long long* hash = snewn(hashsize, unsigned long long);
+  unsigned long long* newhash;
+  Shape* shape;
+  Shape* prev;
+  for (i=dict->toplevel; i<lev; i++) {
+    nr = 0;
+    for (k=0; k<hashsize; k++)
+      hash[k] = 0;
+    for (j=0; j<dict->len[i-1]; j++)
+      for (prev=ShapeDictGet(dict, i, j), x=-1; x<=prev->width; x++)
+        for (y=-1; y<=prev->height; y++)
+          if (can_incr_shape(prev, x, y)) {
+            shape = make_incr_shape(prev, x, y);
+            if (!insert_shape_key(hash, hashsize, shape_key(shape, dict->reflmask))) {
+              free_shape(shape);
+              continue;
+            } else {
+              if (nr == worksize) {
+                newsize = 2*worksize;
+                newwork = snewn(newsize, Shape*);
+                for (k=0; k<worksize; k++)
+                  newwork[k] = work[k];
+                sfree(work);
+                work = newwork;
+                worksize = newsize;
+              }
+              work[nr++] = shape;
+              if (2*nr > hashsize) {
+                newsize = 2*hashsize;
+                newhash = snewn(newsize, unsigned long long);
+                for (k=0; k<newsize; k++)
+                  newhash[k] = 0;
+                for (k=0; k<hashsize; k++)
+                  if (hash[k])
+                    insert_shape_key(newhash, newsize, hash[k]);
+                sfree(hash);
+                hash = newhash;
+                hashsize = newsize;
+              }
+            }
+          }
+    store_shape_level(dict, i+1, work, nr);
+    dict->totnum += nr;
+  }
+  dict->toplevel = lev;
+  sfree(hash);
+  sfree(work);
+}
+
+void free_shape_dictionary(ShapeDict* dict)
+{
+  for (int i=0; i<dict->toplevel; i++) {
+    sfree(dict->shapes[i][0].pix);
+    sfree(dict->shapes[i][0].rows);
+    sfree(dict->shapes[i]);
+    sfree(dict->place[i]);
+  }
+  sfree(dict->shapes);
+  sfree(dict->place);
+  sfree(dict->len);
+  sfree(dict);
+}
+
+void calc_needed_positions(ShapeDict* dict, int lev, int ind, Shape* board, int* smask, int* nr1, int* nr2, int* np1, int* np2)
+{
+  Shape* shape = ShapeDictGet(dict, lev, ind);
+  ShapePlace* pl = &dict->place[lev-1][ind];
+  *smask = pl->smask;
+  *nr1 = pl->nr1;
+  *nr2 = pl->nr2;
   *np1 = (board->width - shape->width + 1)*(board->height - shape->height + 1);
   *np2 = (board->width - shape->height + 1)*(board->height - shape->width + 1);
   if (*np1 < 0) *np1 = 0;
   if (*np2 < 0) *np2 = 0;
 }
 
+int board_rows(Shape* board, unsigned int* on, unsigned int* off)
+{
+  /* Row bitplanes of the known pixels of the padded board, where a blocked
+     pixel is both ON and OFF so that it conflicts with any shape pixel.
+     Returns the number of known pixels. */
+  int num = 0;
+  for (int y=0; y<board->height+2; y++) {
+    on[y] = off[y] = 0;
+    if (y == 0 || y > board->height)
+      continue;
+    for (int x=1; x<=board->width; x++) {
+      char px = board->pix[y*(board->width+2) + x];
+      if (px == ID_ON || px == ID_BLOCKED)
+        on[y] |= 1u << x;
+      if (px == ID_OFF || px == ID_BLOCKED)
+        off[y] |= 1u << x;
+      if (px != ID_UNKNOWN)
+        num++;
+    }
+  }
+  return num;
+}
+
+static int placement_conflicts(const unsigned short* son, int sh, const unsigned int* bon, const unsigned int* boff, int x, int y)
+{
+  /* Whether the orientation with rows son and padded height sh, placed at
+     (x,y), conflicts with the board bitplanes bon and boff */
+  for (int r=0; r<sh; r++)
+    if ((((unsigned int)son[r] << x) & boff[y+r]) | (((unsigned int)son[sh+r] << x) & bon[y+r]))
+      return 1;
+  return 0;
+}
+
+int mark_inconsistent_rows(Shape* board, Shape* shape, int smask, int np1, int np2, char* poss, const unsigned int* bon, const unsigned int* boff, int* ind)
+{
+  /* Mark the placements still possible in poss which conflict with the
+     board bitplanes. If ind is given, their indices are stored there.
+     Returns the number of placements marked. */
+  int n = 0, ir1=0, ir2=0;
+  for (int b=1, i=0; i<8; i++, b<<=1)
+    if (smask&b) {
+      const unsigned short* son = ShapeRows(shape, b);
+      int sh = ShapeHeight(shape, b)+2;
+      int ww = board->width-ShapeWidth(shape, b)+1;
+      int hh = board->height-ShapeHeight(shape, b)+1;
+      int i0 = np1*ir1 + np2*ir2;
+      for (int y=0, k=i0; y<hh; y++)
+        for (int x=0; x<ww; x++, k++)
+          if (poss[k] && placement_conflicts(son, sh, bon, boff, x, y)) {
+            poss[k] = 0;
+            if (ind)
+              ind[n] = k;
+            n++;
+          }
+      if (ID_REFL_SWAP & b)
+        ir2++;
+      else
+        ir1++;
+    }
+  return n;
+}
+
 void mark_inconsistent(Shape* board, Shape* shape, int smask, int np1, int np2, char* poss)
 {
-  int bpix, spix;
-  for (int y=0; y<board->height; y++)
-    for (int x=0; x<board->width; x++)
-      if ((bpix = ShapePix(board, x, y, 1)) != ID_UNKNOWN) {
-        int ir1=0, ir2=0;
-        for (int b=1, i=0; i<8; i++, b<<=1)
-          if (smask&b) {
-            for (int yy = imax(y+ShapeHeight(shape, b)-board->height, -1); yy <= imin(ShapeHeight(shape, b), y); yy++)
-              for (int xx = imax(x+ShapeWidth(shape, b)-board->width, -1); xx <= imin(ShapeWidth(shape, b), x); xx++)
-                if ((spix = ShapePix(shape, xx, yy, b)) != ID_UNKNOWN && spix != bpix)
-                  poss[np1*ir1 + np2*ir2 + (y-yy) * (board->width-ShapeWidth(shape, b)+1) + (x-xx)] = 0;
-            if (ID_REFL_SWAP & b)
-              ir2++;
-            else
-              ir1++;
-            }
+  unsigned int bon[board->height+2], boff[board->height+2];
+  if (board_rows(board, bon, boff))
+    mark_inconsistent_rows(board, shape, smask, np1, np2, poss, bon, boff, 0);
+}
+
+int restore_pixel_possibilities(Shape* board, Shape* shape, int smask, int np1, int np2, char* poss, int x, int y, char val, const unsigned int* bon, const unsigned int* boff, int* ind)
+{
+  /* Board pixel (x,y) has just been set from val (ON or OFF) back to
+     unknown. Visit only the placements of shape with a pixel other than
+     val there, and mark those consistent with the rest of the board, given
+     by the bitplanes bon and boff, as possible again. The restored indices
+     are stored in ind, and their number is returned. */
+  int n = 0, ir1=0, ir2=0;
+  for (int b=1, i=0; i<8; i++, b<<=1)
+    if (smask&b) {
+      const unsigned short* son = ShapeRows(shape, b);
+      int sh = ShapeHeight(shape, b)+2;
+      int ww = board->width-ShapeWidth(shape, b)+1;
+      int hh = board->height-ShapeHeight(shape, b)+1;
+      const unsigned short* conflict = (val == ID_ON ? son+sh : son);
+      int i0 = np1*ir1 + np2*ir2;
+      for (int r=0; r<sh; r++) {
+        int py = y+1-r;
+        if (py < 0 || py >= hh)
+          continue;
+        for (int c=0, m=conflict[r]; m; c++, m>>=1)
+          if ((m&1) && x+1-c >= 0 && x+1-c < ww) {
+            int k = i0 + py*ww + x+1-c;
+            if (!poss[k] && !placement_conflicts(son, sh, bon, boff, x+1-c, py))
+              poss[k] = 1, ind[n++] = k;
+          }
       }
+      if (ID_REFL_SWAP & b)
+        ir2++;
+      else
+        ir1++;
+    }
+  return n;
+}
+
+/*
+ * Placement counts per board pixel are accumulated in packed counters, one
+ * 16 bit lane per padded board column, four to a 64 bit word, so a board
+ * row is four words. A row mask is added a nibble at a time by spreading
+ * it onto the lanes through spread_tab. Counts stay below 8*15*15.
+ */
+
+static const unsigned long long spread_tab[16] = {
+  0x0000000000000000ull, 0x0000000000000001ull, 0x0000000000010000ull, 0x0000000000010001ull,
+  0x0000000100000000ull, 0x0000000100000001ull, 0x0000000100010000ull, 0x0000000100010001ull,
+  0x0001000000000000ull, 0x0001000000000001ull, 0x0001000000010000ull, 0x0001000000010001ull,
+  0x0001000100000000ull, 0x0001000100000001ull, 0x0001000100010000ull, 0x0001000100010001ull
+};
+
+static void add_row_mask(unsigned long long* acc, unsigned int m)
+{
+  acc[0] += spread_tab[m & 15];
+  acc[1] += spread_tab[(m >> 4) & 15];
+  acc[2] += spread_tab[(m >> 8) & 15];
+  acc[3] += spread_tab[(m >> 12) & 15];
 }
 
 void accumulate_possibilities(Shape* board, Shape* shape, int smask, int np1, int np2, char* poss, int* bpos, int* bneg)
 {
-  char spix;
-  for (int y=0; y<board->height; y++)
-    for (int x=0; x<board->width; x++)
-      if (ShapePix(board, x,y,1) == ID_UNKNOWN) {
-        int ir1=0, ir2=0;
-        for (int b=1, i=0; i<8; i++, b<<=1)
-          if (smask&b) {
-            for (int yy = imax(y+ShapeHeight(shape, b)-board->height, -1); yy <= imin(ShapeHeight(shape, b), y); yy++)
-              for (int xx = imax(x+ShapeWidth(shape, b)-board->width, -1); xx <= imin(ShapeWidth(shape, b), x); xx++)
-                if ((spix = ShapePix(shape, xx,yy,b)) != ID_UNKNOWN &&
-                    poss[np1*ir1 + np2*ir2 + (y-yy) * (board->width-ShapeWidth(shape, b)+1) + (x-xx)] != 0) {
-                  if (spix == ID_ON)
-                    bpos[y*board->width + x]++;
-                  else
-                    bneg[y*board->width + x]++;
-                }
-            if (ID_REFL_SWAP & b)
-              ir2++;
-            else
-              ir1++;
+  /* Add to bpos and bneg the number of possible placements with an ON and
+     an OFF pixel on each unknown board pixel. Each orientation is added
+     either a placement at a time, a shape row per step, or a shape pixel
+     at a time, shifting the rows of the bitmap of possible placements onto
+     the board, whichever takes fewer steps. */
+  int nrow = board->height+2, ir1=0, ir2=0;
+  unsigned int bon[nrow], boff[nrow], bunk[nrow];
+  unsigned long long cpos[4*nrow], cneg[4*nrow];
+  board_rows(board, bon, boff);
+  for (int y=0; y<nrow; y++)
+    bunk[y] = (y == 0 || y > board->height ? 0 : ~(bon[y] | boff[y]) & (((1u << board->width) - 1) << 1));
+  for (int i=0; i<4*nrow; i++)
+    cpos[i] = cneg[i] = 0;
+  for (int b=1, i=0; i<8; i++, b<<=1)
+    if (smask&b) {
+      const unsigned short* son = ShapeRows(shape, b);
+      int sw = ShapeWidth(shape, b)+2;
+      int sh = ShapeHeight(shape, b)+2;
+      int ww = board->width-ShapeWidth(shape, b)+1;
+      int hh = board->height-ShapeHeight(shape, b)+1;
+      char* p = poss + np1*ir1 + np2*ir2;
+      unsigned int pm[hh > 0 ? hh : 1];
+      int cnt = 0, npix = 0;
+      for (int y=0; y<hh; y++) {
+        pm[y] = 0;
+        for (int x=0; x<ww; x++)
+          if (p[y*ww + x])
+            pm[y] |= 1u << x, cnt++;
+      }
+      for (int r=0; r<2*sh; r++)
+        for (unsigned int m=son[r]; m; m>>=1)
+          npix += m&1;
+      if (cnt*sh*2 <= npix*hh) {
+        for (int y=0; y<hh; y++)
+          for (int x=0; x<ww; x++)
+            if (pm[y] & (1u << x))
+              for (int r=0; r<sh; r++) {
+                /* Shape pixels on unknown board pixels, in padded columns */
+                add_row_mask(cpos + 4*(y+r), ((unsigned int)son[r] << x) & bunk[y+r]);
+                add_row_mask(cneg + 4*(y+r), ((unsigned int)son[sh+r] << x) & bunk[y+r]);
+              }
+      } else {
+        for (int r=0; r<sh; r++)
+          for (int c=0; c<sw; c++) {
+            unsigned long long* acc = ((son[r] >> c) & 1 ? cpos : (son[sh+r] >> c) & 1 ? cneg : 0);
+            if (acc)
+              for (int y=0; y<hh; y++)
+                add_row_mask(acc + 4*(y+r), (pm[y] << c) & bunk[y+r]);
           }
       }
+      if (ID_REFL_SWAP & b)
+        ir2++;
+      else
+        ir1++;
+    }
+  for (int y=1; y<=board->height; y++)
+    for (int x=1; x<=board->width; x++) {
+      bpos[(y-1)*board->width + x-1] += (cpos[4*y + x/4] >> (16*(x%4))) & 0xffff;
+      bneg[(y-1)*board->width + x-1] += (cneg[4*y + x/4] >> (16*(x%4))) & 0xffff;
+    }
 }
 
 int check_inconsistent(Shape* board, Shape* shape, int bit, int x, int y)
 {
-  char px;
-  for (int yy=-1; yy<=ShapeHeight(shape, bit); yy++)
-    for (int xx=-1; xx<=ShapeWidth(shape, bit); xx++)
-      if ((px = ShapePix(shape, xx, yy, bit)) != ID_UNKNOWN)
-        if (ShapePix(board, xx+x, yy+y, 1) != px && ShapePix(board, xx+x, yy+y, 1) != ID_UNKNOWN)
-          return 1;
+  const unsigned short* son = ShapeRows(shape, bit);
+  int sh = ShapeHeight(shape, bit)+2;
+  for (int r=0; r<sh; r++) {
+    const char* bp = board->pix + (y+r)*(board->width+2) + x;
+    unsigned int on = son[r], off = son[sh+r];
+    for (int c=0; on|off; c++, on>>=1, off>>=1)
+      if (bp[c] != ID_UNKNOWN && (((on&1) && bp[c] != ID_ON) || ((off&1) && bp[c] != ID_OFF)))
+        return 1;
+  }
   return 0;
 }
 
 void copy_to_board(Shape* board, Shape* shape, int bit, int x, int y, char val)
 {
-  char px;
-  for (int yy=-1; yy<=ShapeHeight(shape, bit); yy++)
-    for (int xx=-1; xx<=ShapeWidth(shape, bit); xx++)
-      if ((px = ShapePix(shape, xx, yy, bit)) != ID_UNKNOWN && xx+x >= 0 && xx+x < ShapeWidth(board, 1) && yy+y >= 0 && yy+y < ShapeHeight(board, 1))
-        SetShapePix(board, xx+x, yy+y, 1, (px==ID_ON ? val : px));
+  const unsigned short* son = ShapeRows(shape, bit);
+  int sh = ShapeHeight(shape, bit)+2;
+  for (int r=0; r<sh; r++)
+    if (y+r >= 1 && y+r <= board->height) {
+      char* bp = board->pix + (y+r)*(board->width+2) + x;
+      unsigned int on = son[r], off = son[sh+r];
+      for (int c=0; on|off; c++, on>>=1, off>>=1)
+        if (x+c >= 1 && x+c <= board->width) {
+          if (on&1)
+            bp[c] = val;
+          else if (off&1)
+            bp[c] = ID_OFF;
+        }
+    }
 }
 
-int add_random_board_shape(Shape* board, Shape* shape, int reflmask, int num, random_state *rs)
+/*
+ * A random board is built one shape copy at a time, each placed uniformly
+ * among the positions still consistent with the board. The positions of
+ * every component are kept up to date as shapes are placed, and a
+ * placement is taken back at once if it leaves some component with fewer
+ * positions than copies still to place; another position is then tried
+ * for the same copy. When a copy runs out of positions, the latest
+ * BOARD_BACKJUMP placements are undone instead.
+ *
+ * Most failures come from shapes that cannot be packed at all, so the
+ * number of placements taken back before giving the board up is
+ * BOARD_BACKTRACK_LIMIT times the square of the largest share of the fleet
+ * placed so far, counted afresh whenever that share grows. Such boards are
+ * then dropped about as soon as by placing straight on, while those nearly
+ * done get searched.
+ */
+
+#define BOARD_BACKJUMP 3
+#define BOARD_BACKTRACK_LIMIT 100
+#define BOARD_ATTEMPT_LIMIT 100000
+#define BOARD_ROUND_LIMIT 4
+
+static int random_board_mark(Shape* board, Shape* shape, int smask, int np1, int np2, char* poss, const unsigned int* bon, const unsigned int* boff, int x0, int y0, int x1, int y1)
 {
-  int smask, nr1, nr2, np1, np2;
-  calc_needed_positions(shape, board, reflmask, &smask, &nr1, &nr2, &np1, &np2);
-  
-  int b, i, ww;
-  int possnum, posslen = nr1*np1+nr2*np2;
-  char* poss = snewn(posslen, char);
-  int pick;
-  for (int i=0; i<posslen; i++) poss[i] = 1;
-  while (num--) {
-    mark_inconsistent(board, shape, smask, np1, np2, poss);
-    for (possnum=0, i=0; i<posslen; i++)
-      if (poss[i]) possnum++;
-    if (possnum == 0) {
-      sfree(poss);
+  /* As mark_inconsistent_rows, for a shape just placed with its pixels in
+     columns x0+1..x1 and rows y0+1..y1 of the padded board. Only the
+     placements reaching these can have come to conflict. */
+  int n = 0, ir1=0, ir2=0;
+  for (int b=1, i=0; i<8; i++, b<<=1)
+    if (smask&b) {
+      const unsigned short* son = ShapeRows(shape, b);
+      int sw = ShapeWidth(shape, b), sh = ShapeHeight(shape, b);
+      int ww = board->width-sw+1;
+      int hh = board->height-sh+1;
+      int i0 = np1*ir1 + np2*ir2;
+      for (int y=imax(0, y0-sh); y<=imin(hh-1, y1); y++)
+        for (int x=imax(0, x0-sw), k=i0+y*ww+x; x<=imin(ww-1, x1); x++, k++)
+          if (poss[k] && placement_conflicts(son, sh+2, bon, boff, x, y)) {
+            poss[k] = 0;
+            n++;
+          }
+      if (ID_REFL_SWAP & b)
+        ir2++;
+      else
+        ir1++;
+    }
+  return n;
+}
+
+static int random_board_shape(ShapeDict* dict, ShapeConfig* conf, int i, int* inds, random_state *rs)
+{
+  /* Pick the shape of component i, different from those of the components
+     just before it of the same size, back to one with a given shape */
+  int sameshape[conf->numcomp];
+  int numsame = 0, ind, r, j;
+  if (conf->id[i] > -1)
+    return conf->id[i];
+  for (r=i; r>0 && conf->lev[r-1] == conf->lev[i]; r--)
+    if (conf->id[r-1] > -1) {
+      r--;
+      break;
+    }
+  for (int k=r; k<i; k++, numsame++) {
+    for (j=numsame-1; j>=0 && sameshape[j]>inds[k]; j--)
+      sameshape[j+1] = sameshape[j];
+    sameshape[j+1] = inds[k];
+  }
+  if (ShapeDictNum(dict, conf->lev[i]) <= numsame)
+    return -1;
+  ind = random_upto(rs, ShapeDictNum(dict, conf->lev[i])-numsame);
+  for (j=0; j<numsame; j++)
+    if (ind>=sameshape[j])
+      ind++;
+  return ind;
+}
+
+Shape* make_random_board(ShapeDict* dict, ShapeConfig* conf, int w, int h, int storeshapes, int maxback, random_state *rs)
+{
+  int nc = conf->numcomp, nlev = 0, tot = 0, level = 0, deep = 0, nback = 0, lim = 0, fresh = 1;
+  int inds[nc], smask[nc], np1[nc], np2[nc], off[nc+1];
+  int *lcomp, *lcopy, *lbit, *lpos, *lcount, *lcand;
+  unsigned int *lon, *loff;
+  char *lposs, *cand;
+  Shape* board;
+  for (int k=0; k<nc; k++) {
+    inds[k] = random_board_shape(dict, conf, k, inds, rs);
+    if (inds[k] < 0)
       return 0;
+    nlev += conf->mult[k];
+  }
+  board = make_empty_board(w, h);
+  for (int k=0; k<nc; k++) {
+    int nr1, nr2;
+    calc_needed_positions(dict, conf->lev[k], inds[k], board, &smask[k], &nr1, &nr2, &np1[k], &np2[k]);
+    off[k] = tot;
+    tot += nr1*np1[k] + nr2*np2[k];
+  }
+  off[nc] = tot;
+  lcomp = snewn(nlev, int);
+  lcopy = snewn(nlev, int);
+  lbit = snewn(nlev, int);
+  lpos = snewn(nlev, int);
+  lcand = snewn(nlev, int);
+  lcount = snewn((nlev+1)*nc, int);
+  lon = snewn((nlev+1)*(h+2), unsigned int);
+  loff = snewn((nlev+1)*(h+2), unsigned int);
+  lposs = snewn((nlev+1)*tot, char);
+  cand = snewn(nlev*tot, char);
+  for (int k=0, l=0; k<nc; k++)
+    for (int c=0; c<conf->mult[k]; c++, l++)
+      lcomp[l] = k, lcopy[l] = c;
+  /* On the empty board every placement is possible. The board of each
+     level is kept as the row bitplanes of board_rows. */
+  memset(lposs, 1, tot);
+  for (int k=0; k<nc; k++)
+    lcount[k] = off[k+1] - off[k];
+  board_rows(board, lon, loff);
+  while (level < nlev) {
+    int k = lcomp[level], pick, i, b, sw, sh, x, y, ok;
+    char *poss = lposs + (level+1)*tot, *cp = cand + level*tot + off[k];
+    int *count = lcount + (level+1)*nc;
+    unsigned int *bon = lon + (level+1)*(h+2), *boff = loff + (level+1)*(h+2);
+    Shape* shape = ShapeDictGet(dict, conf->lev[k], inds[k]);
+    const unsigned short* son;
+    if (fresh) {
+      memcpy(cp, lposs + level*tot + off[k], off[k+1] - off[k]);
+      lcand[level] = lcount[level*nc + k];
+      fresh = 0;
     }
-    pick = random_upto(rs, possnum) + 1;
-    for (i=0; i<posslen; i++)
-      if (poss[i]) {
+    if (!lcand[level]) {
+      /* Dead end, so undo the latest placements and try again there */
+      if (level == 0 || nback++ == lim)
+        break;
+      level = imax(0, level - BOARD_BACKJUMP);
+      continue;
+    }
+    pick = random_upto(rs, lcand[level]) + 1;
+    for (i=0; ; i++)
+      if (cp[i]) {
         pick--;
         if (!pick) break;
       }
-    pick=i;
+    /* Not to be tried again if backtracking here, nor for the later copies
+       of the component, as these are interchangeable */
+    cp[i] = 0;
+    lcand[level]--;
+    lposs[level*tot + off[k] + i] = 0;
+    lcount[level*nc + k]--;
+    pick = i;
     for (b=1, i=0; i<8; i++, b<<=1)
-      if (smask & b) {
-        if (pick >= (ID_REFL_SWAP & b ? np2 : np1))
-          pick -= (ID_REFL_SWAP & b ? np2 : np1);
+      if (smask[k] & b) {
+        if (pick >= (ID_REFL_SWAP & b ? np2[k] : np1[k]))
+          pick -= (ID_REFL_SWAP & b ? np2[k] : np1[k]);
         else
           break;
       }
-    ww = (board->width - ShapeWidth(shape, b) + 1);
-    copy_to_board(board, shape, b, pick%ww, pick/ww, ID_BLOCKED);
-  }
-  sfree(poss);
-  return 1;
-}
-
-Shape* make_random_board(ShapeDict* dict, ShapeConfig* conf, int w, int h, int storeshapes, random_state *rs)
-{
-  int sameshape[conf->numcomp];
-  int numsame = 0;
-  int ind;
-  Shape* shape;
-  Shape* board = make_empty_board(w, h);
-  for (int i=0; i<conf->numcomp; i++) {
-    if (conf->id[i] > -1) {
-      ind = conf->id[i];
-      sameshape[0] = ind;
-      numsame = 0;
-    } else if (i>0 && conf->lev[i] == conf->lev[i-1]) {
-      /* Prevent the same shape in different components */
-      int j;
-      numsame++;
-      if (ShapeDictNum(dict, conf->lev[i]) <= numsame) {
-        free_shape(board);
-        return 0;
+    lbit[level] = b;
+    lpos[level] = pick;
+    /* Add the shape to the bitplanes, blocked pixels being both ON and OFF */
+    son = ShapeRows(shape, b);
+    sw = ShapeWidth(shape, b);
+    sh = ShapeHeight(shape, b);
+    x = pick % (w-sw+1);
+    y = pick / (w-sw+1);
+    memcpy(bon, lon + level*(h+2), (h+2)*sizeof(unsigned int));
+    memcpy(boff, loff + level*(h+2), (h+2)*sizeof(unsigned int));
+    for (int r=0; r<sh+2; r++) {
+      bon[y+r] |= (unsigned int)son[r] << x;
+      boff[y+r] |= (unsigned int)(son[r] | son[sh+2+r]) << x;
+    }
+    /* Forward check the components still to be placed */
+    memcpy(poss, lposs + level*tot, tot);
+    memcpy(count, lcount + level*nc, nc*sizeof(int));
+    ok = 1;
+    for (int j=k; j<nc && ok; j++) {
+      count[j] -= random_board_mark(board, ShapeDictGet(dict, conf->lev[j], inds[j]), smask[j], np1[j], np2[j],
+                                    poss + off[j], bon, boff, x, y, x+sw, y+sh);
+      ok = (count[j] >= conf->mult[j] - (j == k ? lcopy[level]+1 : 0));
+    }
+    if (ok) {
+      level++;
+      fresh = 1;
+      if (level > deep) {
+        deep = level;
+        nback = 0;
+        lim = maxback*deep*deep/(nlev*nlev);
       }
-      ind = random_upto(rs, ShapeDictNum(dict, conf->lev[i])-numsame);
-      for (j=0; j<numsame; j++)
-        if (ind>=sameshape[j])
-          ind++;
-      for (j=numsame-1; j>=0 && sameshape[j]>ind; j--)
-        sameshape[j+1] = sameshape[j];
-      sameshape[j+1] = ind;
-    } else {
-      ind = random_upto(rs, ShapeDictNum(dict, conf->lev[i]));
-      sameshape[0] = ind;
-      numsame = 0;
-    }
-    if (storeshapes)
-      conf->id[i] = ind;
-    shape = ShapeDictGet(dict, conf->lev[i], ind);
-    if (!add_random_board_shape(board, shape, dict->reflmask, conf->mult[i], rs)) {
-      free_shape(board);
-      return 0;
+    } else if (nback++ == lim)
+      break;
+  }
+  if (level == nlev)
+    for (int l=0; l<nlev; l++) {
+      Shape* shape = ShapeDictGet(dict, conf->lev[lcomp[l]], inds[lcomp[l]]);
+      int ww = w - ShapeWidth(shape, lbit[l]) + 1;
+      copy_to_board(board, shape, lbit[l], lpos[l]%ww, lpos[l]/ww, ID_BLOCKED);
     }
+  sfree(lcomp);
+  sfree(lcopy);
+  sfree(lbit);
+  sfree(lpos);
+  sfree(lcand);
+  sfree(lcount);
+  sfree(lon);
+  sfree(loff);
+  sfree(lposs);
+  sfree(cand);
+  if (level < nlev) {
+    free_shape(board);
+    return 0;
   }
-  for (int i=0; i<(board->width+2)*(board->height+2); i++)
+  if (storeshapes)
+    for (int i=0; i<nc; i++)
+      conf->id[i] = inds[i];
+  for (int i=0; i<(w+2)*(h+2); i++)
     if (board->pix[i] == ID_BLOCKED)
       board->pix[i] = ID_ON;
     else
@@ -730,15 +1188,17 @@ Shape* make_random_board(ShapeDict* dict, ShapeConfig* conf, int w, int h, int s
   return board;
 }
 
-/*
-Shape* try_make_random_board(ShapeDict* dict, ShapeConfig* conf, int w, int h, int maxiter, random_state *rs)
+Shape* try_make_random_board(ShapeDict* dict, ShapeConfig* conf, int w, int h, int storeshapes, random_state *rs)
 {
-  Shape* board;
-  int iter = 0;
-  while (!(board = make_random_board(dict, conf, w, h, rs)) && iter++ < maxiter);
+  /* Boards of newly picked shapes are tried BOARD_ATTEMPT_LIMIT times in
+     each of BOARD_ROUND_LIMIT rounds, each round searching further. Gives
+     0 if no board was found. */
+  Shape* board = 0;
+  for (int round=0; !board && round<BOARD_ROUND_LIMIT; round++)
+    for (int n=0; !board && n<BOARD_ATTEMPT_LIMIT; n++)
+      board = make_random_board(dict, conf, w, h, storeshapes, BOARD_BACKTRACK_LIMIT << round, rs);
   return board;
 }
-*/
 
 void print_shape(Shape* shape, int reflbit)
 {
@@ -753,7 +1213,7 @@ void print_dictionary(ShapeDict* dict, int lev)
 {
   for (int k=0; k<dict->len[lev-1]; k++) {
     printf("\n%d:\n", k);
-    print_shape(dict->shapes[lev-1][k], 1);
+    print_shape(ShapeDictGet(dict, lev, k), 1);
   }
 }
 
@@ -775,6 +1235,18 @@ ShapeAnswer* init_shape_answer(ShapeConfig* conf)
   return ans;
 }
 
+void copy_shape_answer(ShapeAnswer* dst, ShapeAnswer* src, ShapeConfig* conf)
+{
+  for (int i=0; i<conf->numcomp; i++) {
+    dst->shapeind[i] = src->shapeind[i];
+    for (int j=0; j<conf->mult[i]; j++) {
+      dst->shapex[i][j] = src->shapex[i][j];
+      dst->shapey[i][j] = src->shapey[i][j];
+      dst->shapeb[i][j] = src->shapeb[i][j];
+    }
+  }
+}
+
 void free_shape_answer(ShapeAnswer* ans, int numcomp)
 {
   int i;
@@ -828,10 +1300,90 @@ void dict_statistics_break_symmetry(DictStatistics* stat)
     }
 }
 
+/*
+ * Binomial coefficients. over() is exact as long as the result fits in
+ * a long long, and saturates at OVER_MAX otherwise, which is only used
+ * for comparing complexities. The entropy sums use over_double(), which
+ * falls back to a table of log factorials when the exact value does not
+ * fit, so that many identical components do not overflow the counts.
+ */
+#define OVER_MAX LLONG_MAX
+#define LOGFACT_SIZE 2048
+#define OVERFAST_SIZE 64
+static double logfact_tab[LOGFACT_SIZE];
+static int overfast_tab[OVERFAST_SIZE]; /* Largest n with n^m below OVER_MAX */
+static int logfact_init = 0;
+
+static void init_logfact(void)
+{
+  if (logfact_init)
+    return;
+  logfact_tab[0] = 0.0;
+  for (int k=1; k<LOGFACT_SIZE; k++)
+    logfact_tab[k] = logfact_tab[k-1] + log((double)k);
+  for (int m=1; m<OVERFAST_SIZE; m++) {
+    double lim = floor(pow(2.0, 63.0/m)) - 1.0;
+    overfast_tab[m] = (lim > INT_MAX ? INT_MAX : (int)lim);
+  }
+  logfact_init = 1;
+}
+
+static double logfact(int k)
+{
+  return (k < LOGFACT_SIZE ? logfact_tab[k] : lgamma(k + 1.0));
+}
+
+static long long gcdll(long long a, long long b)
+{
+  while (b) {
+    long long t = a % b;
+    a = b, b = t;
+  }
+  return a;
+}
+
+long long over(int n, int m)
+{
+  long long res = 1;
+  if (m > 0 && m < OVERFAST_SIZE && n >= 0 && n <= overfast_tab[m]) {
+    /* No intermediate product can exceed n^m */
+    for (int k=1; k<=m; n--, k++)
+      res = res*n/k;
+    return res;
+  }
+  for (int k=1; k<=m; n--, k++) {
+    /* res*n is divisible by k, so divide out the common factor first */
+    long long g = gcdll(res, k);
+    long long f = n / (k / g);
+    res /= g;
+    if (f != 0 && llabs(res) > OVER_MAX / llabs(f))
+      return OVER_MAX;
+    res *= f;
+  }
+  return res;
+}
+
+static long long over_add(long long a, long long b)
+{
+  return (a > OVER_MAX - b ? OVER_MAX : a + b);
+}
+
+double over_double(int n, int m)
+{
+  long long res;
+  if (m < 0 || n < m)
+    return 0.0;
+  res = over(n, m);
+  if (res < OVER_MAX)
+    return (double)res;
+  return exp(logfact(n) - logfact(m) - logfact(n-m));
+}
+
 DictStatistics* init_dict_statistics(ShapeDict* dict, ShapeConfig* conf, int w, int h)
 {
   int nr1, nr2, np1, np2, tot;
   DictStatistics* stat = snew(DictStatistics);
+  init_logfact(); /* Filled here, before any search threads start */
   stat->dict = dict;
   stat->conf = conf;
   stat->answer = init_shape_answer(conf);
@@ -845,18 +1397,23 @@ DictStatistics* init_dict_statistics(ShapeDict* dict, ShapeConfig* conf, int w,
   stat->smask = snewn(stat->num, int);
   stat->np1 = snewn(stat->num, int);
   stat->np2 = snewn(stat->num, int);
+  stat->copied = 0;
   stat->poss = snewn(stat->num, char*);
+  stat->totposs = 0;
   for (int j=0, jk=0, k=0; j<stat->num; j++, jk++) {
     if (jk==ShapeDictNum(dict, conf->lev[k]))
       jk = 0, k++;
-    calc_needed_positions(ShapeDictGet(dict, conf->lev[k], jk), stat->board, dict->reflmask, &stat->smask[j], &nr1, &nr2, &np1, &np2);
+    calc_needed_positions(dict, conf->lev[k], jk, stat->board, &stat->smask[j], &nr1, &nr2, &np1, &np2);
     tot = nr1*np1 + nr2*np2;
     stat->lenposs[j] = stat->numposs[j] = tot;
     stat->np1[j] = np1;
     stat->np2[j] = np2;
-    stat->poss[j] = snewn(tot, char);
-    for (int i=0; i<tot; i++) stat->poss[j][i] = 1;
+    stat->totposs += tot;
   }
+  stat->poss[0] = snewn(stat->totposs, char);
+  for (int j=1; j<stat->num; j++)
+    stat->poss[j] = stat->poss[j-1] + stat->lenposs[j-1];
+  for (int i=0; i<stat->totposs; i++) stat->poss[0][i] = 1;
   dict_statistics_constrain_shapes(stat);
   stat->entr = snewn(stat->bsize, double);
   for (int i=0; i<stat->bsize; i++) stat->entr[i] = 0.0;
@@ -868,23 +1425,35 @@ void free_dict_statistics(DictStatistics* stat)
   stat->answer->refcount--;
   if (!stat->answer->refcount)
     free_shape_answer(stat->answer, stat->conf->numcomp);
-  for (int i=0; i<stat->num; i++) {
-    sfree(stat->poss[i]);
-  }
-  sfree(stat->lenposs);
+  sfree(stat->poss[0]);
   sfree(stat->numposs);
   sfree(stat->poss);
-  sfree(stat->smask);
-  sfree(stat->np1);
-  sfree(stat->np2);
+  if (!stat->copied) {
+    sfree(stat->lenposs);
+    sfree(stat->smask);
+    sfree(stat->np1);
+    sfree(stat->np2);
+  }
   sfree(stat->entr);
   free_shape(stat->board);
   sfree(stat);
 }
 
+void assign_dict_statistics(DictStatistics* stat, DictStatistics* stat0)
+{
+  /* Copy the state of stat0 into stat, a copy of the same statistics, which
+     reuses its arrays and keeps the fixed per-shape data */
+  copy_board(stat0->board, stat->board);
+  for (int j=0; j<stat->num; j++)
+    stat->numposs[j] = stat0->numposs[j];
+  for (int i=0; i<stat->totposs; i++)
+    stat->poss[0][i] = stat0->poss[0][i];
+  for (int i=0; i<stat->bsize; i++)
+    stat->entr[i] = stat0->entr[i];
+}
+
 DictStatistics* copy_dict_statistics(DictStatistics* stat0)
 {
-  int nr1, nr2, np1, np2, tot;
   DictStatistics* stat = snew(DictStatistics);
   stat->dict = stat0->dict;
   stat->conf = stat0->conf;
@@ -893,32 +1462,27 @@ DictStatistics* copy_dict_statistics(DictStatistics* stat0)
   stat->num = stat0->num;
   stat->bsize = stat0->bsize;
   stat->board = copy_shape(stat0->board);
-  stat->lenposs = snewn(stat->num, int);
+  stat->lenposs = stat0->lenposs;
+  stat->smask = stat0->smask;
+  stat->np1 = stat0->np1;
+  stat->np2 = stat0->np2;
+  stat->copied = 1;
   stat->numposs = snewn(stat->num, int);
-  stat->smask = snewn(stat->num, int);
-  stat->np1 = snewn(stat->num, int);
-  stat->np2 = snewn(stat->num, int);
   stat->poss = snewn(stat->num, char*);
-  for (int j=0, jk=0, k=0; j<stat->num; j++, jk++) {
-    if (jk==ShapeDictNum(stat->dict, stat->conf->lev[k]))
-      jk = 0, k++;
-    calc_needed_positions(ShapeDictGet(stat->dict, stat->conf->lev[k], jk), stat->board, stat->dict->reflmask, &stat->smask[j], &nr1, &nr2, &np1, &np2);
-    tot = nr1*np1 + nr2*np2;
-    stat->lenposs[j] = stat0->lenposs[j];
-    stat->numposs[j] = stat0->numposs[j];
-    stat->np1[j] = stat0->np1[j];
-    stat->np2[j] = stat0->np2[j];
-    stat->poss[j] = snewn(tot, char);
-    for (int i=0; i<tot; i++) stat->poss[j][i] = stat0->poss[j][i];
-  }
+  stat->totposs = stat0->totposs;
+  stat->poss[0] = snewn(stat->totposs, char);
+  for (int j=1; j<stat->num; j++)
+    stat->poss[j] = stat->poss[j-1] + stat->lenposs[j-1];
   stat->entr = snewn(stat->bsize, double);
-  for (int i=0; i<stat->bsize; i++) stat->entr[i] = stat0->entr[i];
+  assign_dict_statistics(stat, stat0);
   return stat;
 }
 
 void dict_statistics_update_poss(DictStatistics* stat, int x, int y, char val)
 {
-  int spix;
+  /* Board pixel (x,y) has become val. The placements it rules out are
+     those with a pixel other than val there, which are read off the row
+     masks of each orientation, as in restore_pixel_possibilities */
   SetShapePix(stat->board, x, y, 1, val);
   for (int j=0, jk=0, k=0; j<stat->num; j++, jk++) {
     if (jk==ShapeDictNum(stat->dict, stat->conf->lev[k]))
@@ -928,20 +1492,27 @@ void dict_statistics_update_poss(DictStatistics* stat, int x, int y, char val)
       int ir1=0, ir2=0;
       for (int b=1, i=0; i<8; i++, b<<=1)
         if (stat->smask[j]&b) {
-          for (int yy = imax(y+ShapeHeight(shape, b)-stat->board->height, -1); yy <= imin(ShapeHeight(shape, b), y); yy++)
-            for (int xx = imax(x+ShapeWidth(shape, b)-stat->board->width, -1); xx <= imin(ShapeWidth(shape, b), x); xx++)
-              if ((spix = ShapePix(shape, xx,yy,b)) != ID_UNKNOWN && spix != val) {
-                int ind = stat->np1[j]*ir1 + stat->np2[j]*ir2 + (y-yy) * (stat->board->width-ShapeWidth(shape, b)+1) + (x-xx);
-                if (stat->poss[j][ind])
-                  stat->poss[j][ind] = 0, stat->numposs[j]--;
-              }
-          if (stat->numposs[j] < stat->conf->mult[k])
-            stat->numposs[j] = 0;
+          const unsigned short* son = ShapeRows(shape, b);
+          int sh = ShapeHeight(shape, b)+2;
+          int ww = stat->board->width-ShapeWidth(shape, b)+1;
+          int hh = stat->board->height-ShapeHeight(shape, b)+1;
+          const unsigned short* conflict = (val == ID_ON ? son+sh : son);
+          char* p = stat->poss[j] + stat->np1[j]*ir1 + stat->np2[j]*ir2;
+          for (int r=0; r<sh; r++) {
+            int py = y+1-r;
+            if (py < 0 || py >= hh)
+              continue;
+            for (int c=0, m=conflict[r]; m; c++, m>>=1)
+              if ((m&1) && x+1-c >= 0 && x+1-c < ww && p[py*ww + x+1-c])
+                p[py*ww + x+1-c] = 0, stat->numposs[j]--;
+          }
           if (ID_REFL_SWAP & b)
             ir2++;
           else
             ir1++;
         }
+      if (stat->numposs[j] < stat->conf->mult[k])
+        stat->numposs[j] = 0;
     }
   }
   dict_statistics_break_symmetry(stat);
@@ -972,6 +1543,10 @@ static DictHyperIndex* make_hyper_index(DictStatistics* st, int ci)
   dhi->xvec = snewn(maxnposs, int);
   dhi->yvec = snewn(maxnposs, int);
   dhi->bvec = snewn(maxnposs, int);
+  dhi->basenumposs = 0;
+  dhi->undo = 0;
+  dhi->nundo = dhi->undosize = 0;
+  dhi->ind = 0;
   return dhi;
 }
 
@@ -983,9 +1558,41 @@ static void free_hyper_index(DictHyperIndex* dhi)
   sfree(dhi->xvec);
   sfree(dhi->yvec);
   sfree(dhi->bvec);
+  if (dhi->basenumposs) {
+    sfree(dhi->basenumposs);
+    sfree(dhi->undo);
+    sfree(dhi->ind);
+  }
   sfree(dhi);
 }
 
+static void hyper_index_base_possibilities(DictHyperIndex* dhi)
+{
+  /* Mark the possibilities of the other components against origboard once.
+     Each accepted combination then only needs to check the placements still
+     possible there, and next time the ones it cleared are restored. */
+  int maxlen = 1;
+  dhi->basenumposs = snewn(dhi->stat->num, int);
+  for (int k=0, j0=0, n=0; k<dhi->stat->conf->numcomp; j0+=n, k++) {
+    n = ShapeDictNum(dhi->stat->dict, dhi->stat->conf->lev[k]);
+    for (int jk=0; jk<n; jk++)
+      if (k != dhi->comp && dhi->orignumposs[j0+jk]) {
+        int nn=0;
+        maxlen = imax(maxlen, dhi->stat->lenposs[j0+jk]);
+        for (int i=0; i<dhi->stat->lenposs[j0+jk]; i++)
+          dhi->stat->poss[j0+jk][i] = 1;
+        mark_inconsistent(dhi->origboard, ShapeDictGet(dhi->stat->dict, dhi->stat->conf->lev[k], jk), dhi->stat->smask[j0+jk], dhi->stat->np1[j0+jk], dhi->stat->np2[j0+jk], dhi->stat->poss[j0+jk]);
+        for (int i=0; i<dhi->stat->lenposs[j0+jk]; i++)
+          if (dhi->stat->poss[j0+jk][i])
+            nn++;
+        dhi->basenumposs[j0+jk] = nn;
+      }
+  }
+  dhi->undosize = 1024;
+  dhi->undo = snewn(dhi->undosize, int);
+  dhi->ind = snewn(maxlen, int);
+}
+
 static int next_hyper_index(DictHyperIndex* dhi)
 {
   int smask, np1, np2, ii;
@@ -1035,6 +1642,13 @@ static int next_hyper_index(DictHyperIndex* dhi)
       copy_to_board(dhi->stat->board, dhi->shape, dhi->bvec[dhi->pos[ii]], dhi->xvec[dhi->pos[ii]], dhi->yvec[dhi->pos[ii]], ID_ON);
     }
     if (ii==dhi->mult) {
+      unsigned int bon[dhi->stat->board->height+2], boff[dhi->stat->board->height+2];
+      if (!dhi->basenumposs)
+        hyper_index_base_possibilities(dhi);
+      for (int i=0; i<dhi->nundo; i+=2)
+        dhi->stat->poss[dhi->undo[i]][dhi->undo[i+1]] = 1;
+      dhi->nundo = 0;
+      board_rows(dhi->stat->board, bon, boff);
       for (int k=0, j0=0, n=0; k<dhi->stat->conf->numcomp; j0+=n, k++) {
         n = ShapeDictNum(dhi->stat->dict, dhi->stat->conf->lev[k]);
         if (k == dhi->comp) {
@@ -1043,14 +1657,20 @@ static int next_hyper_index(DictHyperIndex* dhi)
         } else {
           for (int jk=0; jk<n; jk++)
             if (dhi->orignumposs[j0+jk]) {
-              int nn=0;
-              for (int i=0; i<dhi->stat->lenposs[j0+jk]; i++)
-                dhi->stat->poss[j0+jk][i] = 1;
-              mark_inconsistent(dhi->stat->board, ShapeDictGet(dhi->stat->dict, dhi->stat->conf->lev[k], jk), dhi->stat->smask[j0+jk], dhi->stat->np1[j0+jk], dhi->stat->np2[j0+jk], dhi->stat->poss[j0+jk]);
-              for (int i=0; i<dhi->stat->lenposs[j0+jk]; i++)
-                if (dhi->stat->poss[j0+jk][i])
-                  nn++;
-              dhi->stat->numposs[j0+jk] = nn;
+              int nc = mark_inconsistent_rows(dhi->stat->board, ShapeDictGet(dhi->stat->dict, dhi->stat->conf->lev[k], jk), dhi->stat->smask[j0+jk], dhi->stat->np1[j0+jk], dhi->stat->np2[j0+jk], dhi->stat->poss[j0+jk], bon, boff, dhi->ind);
+              if (dhi->nundo + 2*nc > dhi->undosize) {
+                int* newundo;
+                while (dhi->nundo + 2*nc > dhi->undosize)
+                  dhi->undosize *= 2;
+                newundo = snewn(dhi->undosize, int);
+                for (int i=0; i<dhi->nundo; i++)
+                  newundo[i] = dhi->undo[i];
+                sfree(dhi->undo);
+                dhi->undo = newundo;
+              }
+              for (int i=0; i<nc; i++)
+                dhi->undo[dhi->nundo++] = j0+jk, dhi->undo[dhi->nundo++] = dhi->ind[i];
+              dhi->stat->numposs[j0+jk] = dhi->basenumposs[j0+jk] - nc;
             }
           if (dhi->stat->conf->lev[k] == dhi->stat->conf->lev[dhi->comp])
             dhi->stat->numposs[j0+dhi->shind] = 0;
@@ -1063,57 +1683,106 @@ static int next_hyper_index(DictHyperIndex* dhi)
   }
 }
 
-long long over(int n, int m)
+/*
+ * The entropy search enumerates placements of whole components depth
+ * first, picking at each depth the remaining component with the fewest
+ * combinations, until the rest are few enough to just count (marginal)
+ * or all are placed (leaf). Each placement of the top level component
+ * is a branch of its own, which makes it possible to search branches on
+ * separate threads, each with its own sums that are added up in branch
+ * order afterwards.
+ */
+
+typedef struct EntropySums {
+  double norm;
+  double* prob;
+  double* sumpos;
+  double* sumneg;
+  ShapeAnswer* answer;
+  int (*stop)(void* ctx); /* Optional, polled to end the search early */
+  void* stopctx;
+} EntropySums;
+
+typedef struct EntropyBranch {
+  DictStatistics* stat; /* The state after the top level placement */
+  int comp;             /* The top level component, or -1 if none */
+  int shind;
+  int* xvec;
+  int* yvec;
+  int* bvec;
+} EntropyBranch;
+
+static int entropy_stopped(EntropySums* sums)
 {
-  long long res = 1;
-  for (int k=1; k<=m; n--, k++)
-    res = res*n/k;
-  return res;
+  return (sums->stop && sums->stop(sums->stopctx));
 }
 
-int dict_statistics_calc_entropy(DictStatistics* stat, int climit)
+static int entropy_pick_component(DictStatistics* stat, int* hicomp, int curr, long long* mincmpl)
 {
+  int mink = -1;
+  *mincmpl = -1;
+  for (int k=0, j0=0, n=0; k<stat->conf->numcomp; j0+=n, k++) {
+    long long cmpl;
+    int ii=0;
+    n = ShapeDictNum(stat->dict, stat->conf->lev[k]);
+    for (ii=0; ii<curr && hicomp[ii] != k; ii++);
+    if (ii<curr)
+      continue;
+    cmpl = 0;
+    for (int jk=0; jk<n; jk++) {
+      if (stat->numposs[j0+jk] >= stat->conf->mult[k])
+        cmpl = over_add(cmpl, over(stat->numposs[j0+jk], stat->conf->mult[k]));
+    }
+    if (mink == -1 || *mincmpl > cmpl)
+      *mincmpl = cmpl, mink = k;
+  }
+  return mink;
+}
+
+static void entropy_search(DictStatistics* stat, EntropyBranch* br, int climit, EntropySums* sums)
+{
+  int top = (br->comp == -1 ? 0 : 1);
   DictStatistics** statvec = snewn(stat->conf->numcomp+1, DictStatistics*);
   DictHyperIndex** hindex = snewn(stat->conf->numcomp, DictHyperIndex*);
   int* hicomp = snewn(stat->conf->numcomp, int);
   int curr;
-  double* sumpos = snewn(stat->bsize, double);
-  double* sumneg = snewn(stat->bsize, double);
-  double* prob = snewn(stat->bsize, double);
-  double norm;
-  norm = 0.0;
-  for (int i=0; i<stat->bsize; i++)
-    prob[i] = 0.0, sumpos[i] = sumneg[i] = 0;
-  curr = 0;
-  statvec[0] = stat;
+  /* Statistics below the top are reused for each depth, not reallocated */
+  for (curr=0; curr<=stat->conf->numcomp; curr++)
+    statvec[curr] = 0;
+  curr = top;
+  statvec[curr] = br->stat;
+  hicomp[0] = br->comp;
   while(1) {
     if (curr < stat->conf->numcomp) {
-      long long mincmpl = -1;
-      int mink = -1;
-      for (int k=0, j0=0, n=0; k<stat->conf->numcomp; j0+=n, k++) {
-        long long cmpl;
-        int ii=0;
-        n = ShapeDictNum(stat->dict, stat->conf->lev[k]);
-        for (ii=0; ii<curr && hicomp[ii] != k; ii++);
-        if (ii<curr)
-          continue;
-        cmpl = 0;
-        for (int jk=0; jk<n; jk++) {
-          if (statvec[curr]->numposs[j0+jk] >= stat->conf->mult[k])
-            cmpl += over(statvec[curr]->numposs[j0+jk], stat->conf->mult[k]);
-        }
-        if (mink == -1 || mincmpl > cmpl)
-          mincmpl = cmpl, mink = k;
-      }
+      long long mincmpl;
+      int mink = entropy_pick_component(statvec[curr], hicomp, curr, &mincmpl);
       if (mincmpl < climit) {
-        statvec[curr+1] = copy_dict_statistics(statvec[curr]);
+        if (statvec[curr+1])
+          assign_dict_statistics(statvec[curr+1], statvec[curr]);
+        else
+          statvec[curr+1] = copy_dict_statistics(statvec[curr]);
         hindex[curr] = make_hyper_index(statvec[curr+1], mink);
         hicomp[curr] = mink;
         curr++;
       } else {
-        long long tmp;
-        int* bpos = snewn(statvec[curr]->bsize, int);
-        int* bneg = snewn(statvec[curr]->bsize, int);
+        /* Marginal counts. Binomials over(numposs - count, mult) only take
+           a few distinct values per shape, so are looked up in overtab,
+           filled on demand for the shape numbered overstamp. */
+        double tmp;
+        int bsize = statvec[curr]->bsize, stamp = 0, maxlen = 0;
+        int* bpos = snewn(bsize, int);
+        int* bneg = snewn(bsize, int);
+        char* bon = snewn(bsize, char);
+        double* overtab;
+        int* overstamp;
+        for (int i=0; i<stat->num; i++)
+          maxlen = imax(maxlen, statvec[curr]->lenposs[i]);
+        overtab = snewn(maxlen+1, double);
+        overstamp = snewn(maxlen+1, int);
+        for (int i=0; i<=maxlen; i++)
+          overstamp[i] = 0;
+        for (int i=0; i<bsize; i++)
+          bon[i] = (ShapePix(stat->board, i%stat->board->width, i/stat->board->width, 1) == ID_ON);
         for (int k=0, j0=0, n=0; k<stat->conf->numcomp; j0+=n, k++) {
           int ii=0;
           n = ShapeDictNum(stat->dict, stat->conf->lev[k]);
@@ -1122,23 +1791,36 @@ int dict_statistics_calc_entropy(DictStatistics* stat, int climit)
             continue;
           for (int jk=0; jk<n; jk++)
             if (statvec[curr]->numposs[j0+jk] >= stat->conf->mult[k]) {
-              char px;
               Shape* shape = ShapeDictGet(stat->dict, stat->conf->lev[k], jk);
-              for (int i=0; i<statvec[curr]->bsize; i++)
+              int np = statvec[curr]->numposs[j0+jk], mult = stat->conf->mult[k];
+              for (int i=0; i<bsize; i++)
                 bpos[i] = bneg[i] = 0;
               accumulate_possibilities(statvec[curr]->board, shape, statvec[curr]->smask[j0+jk], statvec[curr]->np1[j0+jk], statvec[curr]->np2[j0+jk], statvec[curr]->poss[j0+jk], bpos, bneg);
-              tmp = over(statvec[curr]->numposs[j0+jk], stat->conf->mult[k]);
-              norm += tmp;
-              for (int i=0; i<statvec[curr]->bsize; i++) {
-                px = ShapePix(stat->board, i%stat->board->width, i/stat->board->width, 1);
-                prob[i] += tmp*imin(statvec[curr]->numposs[j0+jk], stat->conf->mult[k]*bpos[i])/((double)statvec[curr]->numposs[j0+jk]);
-                sumpos[i] += (bpos[i]==0 ? 0 : over(statvec[curr]->numposs[j0+jk] - bneg[i], stat->conf->mult[k]));
-                sumneg[i] += (px==ID_ON ? 0 : over(statvec[curr]->numposs[j0+jk] - bpos[i], stat->conf->mult[k]));
+              tmp = over_double(np, mult);
+              sums->norm += tmp;
+              stamp++;
+              for (int i=0; i<bsize; i++) {
+                sums->prob[i] += tmp*imin(np, mult*bpos[i])/((double)np);
+                if (bpos[i]) {
+                  int t = np - bneg[i];
+                  if (overstamp[t] != stamp)
+                    overtab[t] = over_double(t, mult), overstamp[t] = stamp;
+                  sums->sumpos[i] += overtab[t];
+                }
+                if (!bon[i]) {
+                  int t = np - bpos[i];
+                  if (overstamp[t] != stamp)
+                    overtab[t] = over_double(t, mult), overstamp[t] = stamp;
+                  sums->sumneg[i] += overtab[t];
+                }
               }
             }
         }
         sfree(bpos);
         sfree(bneg);
+        sfree(bon);
+        sfree(overtab);
+        sfree(overstamp);
       }
     } else {
       int brnumon = 0, exnumon = 0;
@@ -1150,57 +1832,422 @@ int dict_statistics_calc_entropy(DictStatistics* stat, int climit)
             brnumon += 1;
         }
       if (exnumon == brnumon) {
-        norm += 1;
+        sums->norm += 1;
         for (int i=0, y=0; i<statvec[curr]->bsize; y++)
           for (int x=0; x<statvec[curr]->board->width; x++, i++) {
             if (ShapePix(statvec[curr]->board, x,y,1) == ID_ON) {
-              prob[i] += 1;
-              sumpos[i] += 1;
+              sums->prob[i] += 1;
+              sums->sumpos[i] += 1;
             } else {
-              sumneg[i] += 1;
+              sums->sumneg[i] += 1;
             }
           }
-        if (norm == 1.0) {
+        if (sums->norm == 1.0) {
           for (int i=0; i<curr; i++) {
-            stat->answer->shapeind[hicomp[i]] = hindex[i]->shind;
+            sums->answer->shapeind[hicomp[i]] = (i<top ? br->shind : hindex[i]->shind);
             for (int j=0; j<stat->conf->mult[hicomp[i]]; j++) {
-              stat->answer->shapex[hicomp[i]][j] = hindex[i]->xvec[hindex[i]->pos[j]];
-              stat->answer->shapey[hicomp[i]][j] = hindex[i]->yvec[hindex[i]->pos[j]];
-              stat->answer->shapeb[hicomp[i]][j] = hindex[i]->bvec[hindex[i]->pos[j]];
+              sums->answer->shapex[hicomp[i]][j] = (i<top ? br->xvec[j] : hindex[i]->xvec[hindex[i]->pos[j]]);
+              sums->answer->shapey[hicomp[i]][j] = (i<top ? br->yvec[j] : hindex[i]->yvec[hindex[i]->pos[j]]);
+              sums->answer->shapeb[hicomp[i]][j] = (i<top ? br->bvec[j] : hindex[i]->bvec[hindex[i]->pos[j]]);
             }
           }
         } else {
           for (int i=0; i<curr; i++)
-            stat->answer->shapeind[hicomp[i]] = -1;
+            sums->answer->shapeind[hicomp[i]] = -1;
         }
       }
     }
-    while (curr > 0 && !next_hyper_index(hindex[curr-1])) {
-      free_dict_statistics(statvec[curr]);
+    if (entropy_stopped(sums)) {
+      while (curr > top)
+        free_hyper_index(hindex[--curr]);
+      break;
+    }
+    while (curr > top && !next_hyper_index(hindex[curr-1])) {
       curr--;
       free_hyper_index(hindex[curr]);
     }
-    if (curr == 0)
+    if (curr == top)
+      break;
+  }
+  for (curr=top+1; curr<=stat->conf->numcomp && statvec[curr]; curr++)
+    free_dict_statistics(statvec[curr]);
+  sfree(hicomp);
+  sfree(statvec);
+  sfree(hindex);
+}
+
+static void set_entropy_branch(EntropyBranch* br, DictHyperIndex* dhi, DictStatistics* st)
+{
+  br->stat = st;
+  br->comp = dhi->comp;
+  br->shind = dhi->shind;
+  for (int j=0; j<dhi->mult; j++) {
+    br->xvec[j] = dhi->xvec[dhi->pos[j]];
+    br->yvec[j] = dhi->yvec[dhi->pos[j]];
+    br->bvec[j] = dhi->bvec[dhi->pos[j]];
+  }
+}
+
+#ifdef PARALLEL_GENERATION
+
+typedef struct ParallelEntropy {
+  DictStatistics* stat;
+  EntropyBranch* br;
+  EntropySums* sums;
+  int nbr, climit;
+  pthread_mutex_t lock;
+  int next;
+} ParallelEntropy;
+
+static void* parallel_entropy_worker(void* arg)
+{
+  ParallelEntropy* pe = (ParallelEntropy*)arg;
+  int k;
+  while (1) {
+    pthread_mutex_lock(&pe->lock);
+    k = pe->next++;
+    pthread_mutex_unlock(&pe->lock);
+    if (k >= pe->nbr || entropy_stopped(&pe->sums[k]))
       break;
+    entropy_search(pe->stat, &pe->br[k], pe->climit, &pe->sums[k]);
+  }
+  return NULL;
+}
+
+static void parallel_entropy_search(DictStatistics* stat, DictHyperIndex* dhi, int climit, EntropySums* sums)
+{
+  /* Collect the top level branches, search them on separate threads with
+     separate sums, and add these up in branch order, so that the result
+     does not depend on the number of threads or their timing */
+  ParallelEntropy pe;
+  pthread_t threads[MAX_GENERATION_THREADS];
+  long nt = sysconf(_SC_NPROCESSORS_ONLN);
+  int size = 16, started, k, i;
+  EntropyBranch* tmpbr;
+  if (nt < 1) nt = 1;
+  if (nt > MAX_GENERATION_THREADS) nt = MAX_GENERATION_THREADS;
+  pe.stat = stat;
+  pe.climit = climit;
+  pe.br = snewn(size, EntropyBranch);
+  pe.nbr = 0;
+  pe.next = 0;
+  while (next_hyper_index(dhi)) {
+    if (pe.nbr == size) {
+      tmpbr = snewn(2*size, EntropyBranch);
+      for (k=0; k<size; k++)
+        tmpbr[k] = pe.br[k];
+      sfree(pe.br);
+      pe.br = tmpbr;
+      size *= 2;
+    }
+    pe.br[pe.nbr].xvec = snewn(dhi->mult, int);
+    pe.br[pe.nbr].yvec = snewn(dhi->mult, int);
+    pe.br[pe.nbr].bvec = snewn(dhi->mult, int);
+    set_entropy_branch(&pe.br[pe.nbr], dhi, copy_dict_statistics(dhi->stat));
+    pe.nbr++;
+  }
+  pe.sums = snewn(pe.nbr, EntropySums);
+  for (k=0; k<pe.nbr; k++) {
+    pe.sums[k].norm = 0.0;
+    pe.sums[k].prob = snewn(stat->bsize, double);
+    pe.sums[k].sumpos = snewn(stat->bsize, double);
+    pe.sums[k].sumneg = snewn(stat->bsize, double);
+    for (i=0; i<stat->bsize; i++)
+      pe.sums[k].prob[i] = pe.sums[k].sumpos[i] = pe.sums[k].sumneg[i] = 0.0;
+    pe.sums[k].answer = init_shape_answer(stat->conf);
+    pe.sums[k].stop = sums->stop;
+    pe.sums[k].stopctx = sums->stopctx;
+    /* Copies below the branch share its answer, so give it a private one */
+    pe.br[k].stat->answer->refcount--;
+    pe.br[k].stat->answer = pe.sums[k].answer;
+    pe.br[k].stat->answer->refcount++;
+  }
+  pthread_mutex_init(&pe.lock, NULL);
+  for (i=0, started=0; i<nt && i<pe.nbr; i++)
+    if (!pthread_create(&threads[started], NULL, parallel_entropy_worker, &pe))
+      started++;
+  if (!started)
+    parallel_entropy_worker(&pe);
+  for (i=0; i<started; i++)
+    pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&pe.lock);
+  for (k=0; k<pe.nbr; k++) {
+    sums->norm += pe.sums[k].norm;
+    for (i=0; i<stat->bsize; i++) {
+      sums->prob[i] += pe.sums[k].prob[i];
+      sums->sumpos[i] += pe.sums[k].sumpos[i];
+      sums->sumneg[i] += pe.sums[k].sumneg[i];
+    }
+  }
+  for (k=0; k<pe.nbr; k++) {
+    /* A unique solution comes from a single leaf, which recorded it */
+    if (sums->norm == 1.0 && pe.sums[k].norm == 1.0)
+      copy_shape_answer(sums->answer, pe.sums[k].answer, stat->conf);
+    free_dict_statistics(pe.br[k].stat);
+    free_shape_answer(pe.sums[k].answer, stat->conf->numcomp);
+    sfree(pe.sums[k].prob);
+    sfree(pe.sums[k].sumpos);
+    sfree(pe.sums[k].sumneg);
+    sfree(pe.br[k].xvec);
+    sfree(pe.br[k].yvec);
+    sfree(pe.br[k].bvec);
+  }
+  sfree(pe.sums);
+  sfree(pe.br);
+}
+
+#endif /* PARALLEL_GENERATION */
+
+int dict_statistics_calc_entropy_until(DictStatistics* stat, int climit, int (*stop)(void* ctx), void* stopctx, int serial)
+{
+  /* If stop() returns true the search ends early, and entr and the return
+     value only reflect the placements counted so far. With serial set the
+     search stays on the calling thread, as when that is one of several
+     already running. */
+  EntropySums sums;
+  EntropyBranch br;
+  long long mincmpl;
+  int mink;
+  sums.stop = stop;
+  sums.stopctx = stopctx;
+  sums.norm = 0.0;
+  sums.prob = snewn(stat->bsize, double);
+  sums.sumpos = snewn(stat->bsize, double);
+  sums.sumneg = snewn(stat->bsize, double);
+  sums.answer = stat->answer;
+  for (int i=0; i<stat->bsize; i++)
+    sums.prob[i] = 0.0, sums.sumpos[i] = sums.sumneg[i] = 0;
+  mink = entropy_pick_component(stat, 0, 0, &mincmpl);
+  if (mincmpl < climit) {
+    DictStatistics* st1 = copy_dict_statistics(stat);
+    DictHyperIndex* dhi = make_hyper_index(st1, mink);
+#ifdef PARALLEL_GENERATION
+    if (!serial)
+      parallel_entropy_search(stat, dhi, climit, &sums);
+    else
+#endif
+    {
+      br.xvec = snewn(dhi->mult, int);
+      br.yvec = snewn(dhi->mult, int);
+      br.bvec = snewn(dhi->mult, int);
+      while (!entropy_stopped(&sums) && next_hyper_index(dhi)) {
+        set_entropy_branch(&br, dhi, st1);
+        entropy_search(stat, &br, climit, &sums);
+      }
+      sfree(br.xvec);
+      sfree(br.yvec);
+      sfree(br.bvec);
+    }
+    free_hyper_index(dhi);
+    free_dict_statistics(st1);
+  } else {
+    br.stat = stat;
+    br.comp = -1;
+    entropy_search(stat, &br, climit, &sums);
   }
-  if (norm > 0.0) {
+  if (sums.norm > 0.0) {
     for (int i=0; i<stat->bsize; i++) {
-      prob[i] /= norm;
-      if (prob[i]==0.0 || prob[i]==1.0 || sumpos[i]==0 || sumneg[i]==0)
+      sums.prob[i] /= sums.norm;
+      if (sums.prob[i]==0.0 || sums.prob[i]==1.0 || sums.sumpos[i]==0 || sums.sumneg[i]==0)
         stat->entr[i] = 0.0;
       else
-        stat->entr[i] = log(norm) - prob[i]*log(sumpos[i]) - (1.0-prob[i])*log(sumneg[i]);
+        stat->entr[i] = log(sums.norm) - sums.prob[i]*log(sums.sumpos[i]) - (1.0-sums.prob[i])*log(sums.sumneg[i]);
     }
   }
-  sfree(sumpos);
-  sfree(sumneg);
-  sfree(prob);
-  sfree(hicomp);
-  sfree(statvec);
-  sfree(hindex);
-  return (norm == 0.0 ? -1 : norm == 1.0 ? 1 : 0);
+  sfree(sums.sumpos);
+  sfree(sums.sumneg);
+  sfree(sums.prob);
+  return (sums.norm == 0.0 ? -1 : sums.norm == 1.0 ? 1 : 0);
+}
+
+int dict_statistics_calc_entropy(DictStatistics* stat, int climit)
+{
+  return dict_statistics_calc_entropy_until(stat, climit, 0, 0, 0);
+}
+
+#ifdef PARALLEL_GENERATION
+
+/*
+ * Sampled entropies, for the computer's Duel guess when its exact search
+ * has not finished in time. A sample places the components in order,
+ * picking the shape and position of the first copy uniformly among all
+ * placements still consistent with the board and the shapes placed so
+ * far, and each further copy among the remaining placements of that
+ * shape. Its weight is the product of the number of choices, divided by
+ * mult! for the order of the copies, or zero if a known ON square is left
+ * uncovered, which makes the mean weight an unbiased estimate of the
+ * number of solutions. The ON probability of a square is then the
+ * weighted fraction of samples covering it.
+ */
+
+#define SAMPLE_BATCH 64
+#define SAMPLE_MIN_HITS 32
+
+static int sample_shape_taken(DictStatistics* stat, int* shind, int k, int jk)
+{
+  /* Whether shape jk of component k is ruled out by the shapes already
+     chosen, as in dict_statistics_break_symmetry */
+  for (int kk=0; kk<k; kk++)
+    if (stat->conf->lev[kk] == stat->conf->lev[k]) {
+      if (shind[kk] == jk)
+        return 1;
+      if (kk == k-1 && stat->conf->id[kk] == -1 &&
+          stat->conf->mult[kk] == stat->conf->mult[k] && jk < shind[kk])
+        return 1;
+    }
+  return 0;
+}
+
+static int sample_candidates(DictStatistics* stat, Shape* shape, int j, const unsigned int* bon, const unsigned int* boff, int* candj, int* candk, int n)
+{
+  /* Append the possible placements of shape j which fit the bitplanes */
+  int ir1=0, ir2=0;
+  for (int b=1, i=0; i<8; i++, b<<=1)
+    if (stat->smask[j]&b) {
+      const unsigned short* son = ShapeRows(shape, b);
+      int sh = ShapeHeight(shape, b)+2;
+      int ww = stat->board->width-ShapeWidth(shape, b)+1;
+      int hh = stat->board->height-ShapeHeight(shape, b)+1;
+      int i0 = stat->np1[j]*ir1 + stat->np2[j]*ir2;
+      for (int y=0, k=i0; y<hh; y++)
+        for (int x=0; x<ww; x++, k++)
+          if (stat->poss[j][k] && !placement_conflicts(son, sh, bon, boff, x, y))
+            candj[n] = j, candk[n] = k, n++;
+      if (ID_REFL_SWAP & b)
+        ir2++;
+      else
+        ir1++;
+    }
+  return n;
+}
+
+static void sample_place(DictStatistics* stat, Shape* shape, int j, int k, unsigned int* bon, unsigned int* boff, unsigned int* cov)
+{
+  /* Add placement k of shape j to the bitplanes, and its squares to cov */
+  for (int b=1, i=0; i<8; i++, b<<=1)
+    if (stat->smask[j]&b) {
+      int n = (ID_REFL_SWAP & b ? stat->np2[j] : stat->np1[j]);
+      if (k < n) {
+        const unsigned short* son = ShapeRows(shape, b);
+        int sh = ShapeHeight(shape, b)+2;
+        int ww = stat->board->width-ShapeWidth(shape, b)+1;
+        int x = k%ww, y = k/ww;
+        for (int r=0; r<sh; r++) {
+          bon[y+r] |= (unsigned int)son[r] << x;
+          cov[y+r] |= (unsigned int)son[r] << x;
+          boff[y+r] |= (unsigned int)son[sh+r] << x;
+        }
+        return;
+      }
+      k -= n;
+    }
+}
+
+static int dict_statistics_sample_entropy(DictStatistics* stat, int maxsamples, double maxerr, double maxtime, random_state *rs, double* prob, double* err)
+{
+  /* Fill in entr from at most maxsamples samples, stopping early after
+     maxtime seconds of processor time or when the standard error of every
+     probability is below maxerr, if these are positive. The probabilities
+     and their standard errors are stored in prob and err unless null.
+     Returns -1 if no consistent sample was found, and 0 otherwise. */
+  int w = stat->board->width, h = stat->board->height;
+  unsigned int bon0[h+2], boff0[h+2], bon[h+2], boff[h+2], cov[h+2];
+  int* candj = snewn(stat->totposs, int);
+  int* candk = snewn(stat->totposs, int);
+  int* shind = snewn(stat->conf->numcomp, int);
+  int* used;
+  double* sumon = snewn(stat->bsize, double);
+  double* sumon2 = snewn(stat->bsize, double);
+  double sumw = 0.0, sumw2 = 0.0;
+  int hits = 0, maxmult = 1;
+  clock_t start = clock();
+  for (int k=0; k<stat->conf->numcomp; k++)
+    maxmult = imax(maxmult, stat->conf->mult[k]);
+  used = snewn(maxmult, int);
+  board_rows(stat->board, bon0, boff0);
+  for (int i=0; i<stat->bsize; i++)
+    sumon[i] = sumon2[i] = 0.0;
+  for (int s=0; s<maxsamples; s++) {
+    double wt = 1.0;
+    for (int y=0; y<h+2; y++)
+      bon[y] = bon0[y], boff[y] = boff0[y], cov[y] = 0;
+    for (int k=0, j0=0, n=0; k<stat->conf->numcomp && wt > 0.0; j0+=n, k++) {
+      int nc = 0, nused = 0, j = -1, pick;
+      Shape* shape = 0;
+      n = ShapeDictNum(stat->dict, stat->conf->lev[k]);
+      for (int jk=0; jk<n; jk++)
+        if (stat->numposs[j0+jk] >= stat->conf->mult[k] && !sample_shape_taken(stat, shind, k, jk))
+          nc = sample_candidates(stat, ShapeDictGet(stat->dict, stat->conf->lev[k], jk), j0+jk, bon, boff, candj, candk, nc);
+      for (int c=0; c<stat->conf->mult[k]; c++) {
+        if (c > 0)
+          nc = sample_candidates(stat, shape, j, bon, boff, candj, candk, 0);
+        if (nc == 0) {
+          wt = 0.0;
+          break;
+        }
+        pick = random_upto(rs, nc);
+        if (c == 0) {
+          j = candj[pick];
+          shape = ShapeDictGet(stat->dict, stat->conf->lev[k], j-j0);
+          shind[k] = j-j0;
+        }
+        wt *= nc/(double)(c+1);
+        sample_place(stat, shape, j, candk[pick], bon, boff, cov);
+        /* The same position cannot be taken twice */
+        stat->poss[j][candk[pick]] = 0;
+        used[nused++] = candk[pick];
+      }
+      for (int i=0; i<nused; i++)
+        stat->poss[j][used[i]] = 1;
+    }
+    for (int y=1; y<=h && wt > 0.0; y++)
+      if (bon0[y] & ~cov[y])
+        wt = 0.0;
+    if (wt > 0.0) {
+      hits++;
+      sumw += wt;
+      sumw2 += wt*wt;
+      for (int y=0, i=0; y<h; y++)
+        for (int x=0; x<w; x++, i++)
+          if (cov[y+1] & (1u << (x+1)))
+            sumon[i] += wt, sumon2[i] += wt*wt;
+    }
+    if ((s+1) % SAMPLE_BATCH == 0) {
+      if (maxtime > 0.0 && clock() - start >= maxtime*CLOCKS_PER_SEC)
+        break;
+      if (maxerr > 0.0 && hits >= SAMPLE_MIN_HITS) {
+        int i;
+        for (i=0; i<stat->bsize; i++) {
+          double p = sumon[i]/sumw;
+          if (sumon2[i]*(1.0-2.0*p) + p*p*sumw2 > maxerr*maxerr*sumw*sumw)
+            break;
+        }
+        if (i == stat->bsize)
+          break;
+      }
+    }
+  }
+  if (sumw > 0.0)
+    for (int i=0; i<stat->bsize; i++) {
+      double p = sumon[i]/sumw;
+      double v = sumon2[i]*(1.0-2.0*p) + p*p*sumw2;
+      stat->entr[i] = (p <= 0.0 || p >= 1.0 ? 0.0 : -p*log(p) - (1.0-p)*log(1.0-p));
+      if (prob)
+        prob[i] = p;
+      if (err)
+        err[i] = (v > 0.0 ? sqrt(v)/sumw : 0.0);
+    }
+  sfree(candj);
+  sfree(candk);
+  sfree(shind);
+  sfree(used);
+  sfree(sumon);
+  sfree(sumon2);
+  return (sumw > 0.0 ? 0 : -1);
 }
 
+#endif /* PARALLEL_GENERATION */
+
 void dict_statistics_pick_best_entropy(DictStatistics* stat, Shape* solboard, char solval, random_state *rs, double* entr, int* x, int* y)
 {
   double maxentr;
@@ -1271,42 +2318,227 @@ void dict_statistics_fill_board(DictStatistics* stat)
   }
 }
 
+typedef struct PruneLog {
+  int* v; /* Pairs of shape and placement index */
+  int n, size;
+} PruneLog;
+
+static void prune_restore_pixel(DictStatistics* stat, int* count, int x, int y, char px, int* ind, PruneLog* log)
+{
+  /* Set the known pixel (x,y) to unknown, and mark the placements it
+     ruled out which fit the rest of the board as possible again, logging
+     them in log unless it is null */
+  unsigned int bon[stat->board->height+2], boff[stat->board->height+2];
+  SetShapePix(stat->board, x, y, 1, ID_UNKNOWN);
+  board_rows(stat->board, bon, boff);
+  if (log)
+    log->n = 0;
+  for (int k=0, j0=0, n=0; k<stat->conf->numcomp; j0+=n, k++) {
+    n = ShapeDictNum(stat->dict, stat->conf->lev[k]);
+    for (int jk=0; jk<n; jk++) {
+      int nn = restore_pixel_possibilities(stat->board, ShapeDictGet(stat->dict, stat->conf->lev[k], jk), stat->smask[j0+jk], stat->np1[j0+jk], stat->np2[j0+jk], stat->poss[j0+jk], x, y, px, bon, boff, ind);
+      if (log) {
+        if (log->n + 2*nn > log->size) {
+          int* newlog;
+          while (log->n + 2*nn > log->size)
+            log->size *= 2;
+          newlog = snewn(log->size, int);
+          for (int ii=0; ii<log->n; ii++)
+            newlog[ii] = log->v[ii];
+          sfree(log->v);
+          log->v = newlog;
+        }
+        for (int ii=0; ii<nn; ii++)
+          log->v[log->n++] = j0+jk, log->v[log->n++] = ind[ii];
+      }
+      count[j0+jk] += nn;
+      stat->numposs[j0+jk] = count[j0+jk];
+    }
+  }
+}
+
+#ifdef PARALLEL_GENERATION
+
+/*
+ * Speculative pruning: a batch of the next known pixels is tested at once,
+ * each on its own copy of the statistics with only that pixel removed.
+ * The results are then taken in the original order up to and including
+ * the first removal that keeps the solution unique, since the tests after
+ * it in the batch did not see it, and those are tested again. The board
+ * thus ends up the same as when testing one pixel at a time.
+ */
+
+typedef struct ParallelPrune {
+  DictStatistics* stat; /* The board and possibilities so far */
+  int* count;
+  DictStatistics** work;
+  int** wcount;
+  int** wind;
+  int* cand;            /* Pixel of each test in the batch */
+  int* unique;          /* Result of each test */
+  int ncand, next;
+  pthread_mutex_t lock;
+} ParallelPrune;
+
+static void* parallel_prune_worker(void* arg)
+{
+  ParallelPrune* pp = (ParallelPrune*)arg;
+  int k;
+  while (1) {
+    DictStatistics* st;
+    int x, y;
+    pthread_mutex_lock(&pp->lock);
+    k = pp->next++;
+    pthread_mutex_unlock(&pp->lock);
+    if (k >= pp->ncand)
+      break;
+    st = pp->work[k];
+    x = pp->cand[k] % st->board->width;
+    y = pp->cand[k] / st->board->width;
+    assign_dict_statistics(st, pp->stat);
+    for (int j=0; j<st->num; j++)
+      pp->wcount[k][j] = pp->count[j];
+    prune_restore_pixel(st, pp->wcount[k], x, y, ShapePix(pp->stat->board, x, y, 1), pp->wind[k], 0);
+    dict_statistics_constrain_shapes(st);
+    dict_statistics_break_symmetry(st);
+    /* Each test on its own thread, so no further threads inside */
+    pp->unique[k] = (dict_statistics_calc_entropy_until(st, COMPLEXITY_LIMIT, 0, 0, 1) == 1);
+  }
+  return NULL;
+}
+
+static void parallel_prune_pixels(DictStatistics* stat, int* order, int* count, int* ind, int indsize, int nt)
+{
+  ParallelPrune pp;
+  pthread_t threads[MAX_GENERATION_THREADS];
+  int sz = stat->board->width * stat->board->height;
+  int i = 0, ii, k, started;
+  pp.stat = stat;
+  pp.count = count;
+  pp.work = snewn(nt, DictStatistics*);
+  pp.wcount = snewn(nt, int*);
+  pp.wind = snewn(nt, int*);
+  pp.cand = snewn(nt, int);
+  pp.unique = snewn(nt, int);
+  for (k=0; k<nt; k++) {
+    pp.work[k] = copy_dict_statistics(stat);
+    /* The tests each write their own answer */
+    pp.work[k]->answer->refcount--;
+    pp.work[k]->answer = init_shape_answer(stat->conf);
+    pp.wcount[k] = snewn(stat->num, int);
+    pp.wind[k] = snewn(indsize, int);
+  }
+  pthread_mutex_init(&pp.lock, NULL);
+  while (1) {
+    int pos[MAX_GENERATION_THREADS];
+    pp.ncand = 0;
+    for (ii=i; ii<sz && pp.ncand<nt; ii++)
+      if (ShapePix(stat->board, order[ii] % stat->board->width, order[ii] / stat->board->width, 1) != ID_UNKNOWN)
+        pos[pp.ncand] = ii, pp.cand[pp.ncand++] = order[ii];
+    if (!pp.ncand)
+      break;
+    pp.next = 0;
+    for (k=0, started=0; k<pp.ncand; k++)
+      if (!pthread_create(&threads[started], NULL, parallel_prune_worker, &pp))
+        started++;
+    if (!started)
+      parallel_prune_worker(&pp);
+    for (k=0; k<started; k++)
+      pthread_join(threads[k], NULL);
+    for (k=0; k<pp.ncand && !pp.unique[k]; k++);
+    if (k < pp.ncand) {
+      int x = pp.cand[k] % stat->board->width;
+      int y = pp.cand[k] / stat->board->width;
+      prune_restore_pixel(stat, count, x, y, ShapePix(stat->board, x, y, 1), ind, 0);
+      i = pos[k]+1;
+    } else
+      i = ii;
+  }
+  pthread_mutex_destroy(&pp.lock);
+  for (k=0; k<nt; k++) {
+    free_dict_statistics(pp.work[k]);
+    sfree(pp.wcount[k]);
+    sfree(pp.wind[k]);
+  }
+  sfree(pp.work);
+  sfree(pp.wcount);
+  sfree(pp.wind);
+  sfree(pp.cand);
+  sfree(pp.unique);
+}
+
+#endif /* PARALLEL_GENERATION */
+
 void dict_statistics_prune_superfluous(DictStatistics* stat, random_state *rs)
 {
+  /* Try to remove each known pixel in random order. The possibilities are
+     marked against the full board once, and then only the placements on
+     the removed pixel are updated, and reverted along with the pixel if
+     the solution does not stay unique. */
   int sz = stat->board->width * stat->board->height;
   int* order = snewn(sz, int);
+  int* count = snewn(stat->num, int);
+  int* ind;
+  int indsize, maxlev = 1;
+  PruneLog log;
+#ifdef PARALLEL_GENERATION
+  long nt = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  for (int k=0; k<stat->conf->numcomp; k++)
+    maxlev = imax(maxlev, stat->conf->lev[k]);
+  indsize = 8*(maxlev+2)*(maxlev+2);
+  ind = snewn(indsize, int);
   for (int i=0; i<sz; i++)
     order[i]=i;
   for (int i=0; i<sz; i++) {
     int tmp, j = random_upto(rs, sz-i) + i;
     tmp = order[i], order[i] = order[j], order[j] = tmp;
   }
+  for (int k=0, j0=0, n=0; k<stat->conf->numcomp; j0+=n, k++) {
+    n = ShapeDictNum(stat->dict, stat->conf->lev[k]);
+    for (int jk=0; jk<n; jk++) {
+      int nn=0;
+      for (int ii=0; ii<stat->lenposs[j0+jk]; ii++)
+        stat->poss[j0+jk][ii] = 1;
+      mark_inconsistent(stat->board, ShapeDictGet(stat->dict, stat->conf->lev[k], jk), stat->smask[j0+jk], stat->np1[j0+jk], stat->np2[j0+jk], stat->poss[j0+jk]);
+      for (int ii=0; ii<stat->lenposs[j0+jk]; ii++)
+        if (stat->poss[j0+jk][ii])
+          nn++;
+      count[j0+jk] = nn;
+    }
+  }
+#ifdef PARALLEL_GENERATION
+  if (nt > MAX_GENERATION_THREADS) nt = MAX_GENERATION_THREADS;
+  if (nt > 1) {
+    parallel_prune_pixels(stat, order, count, ind, indsize, nt);
+    sfree(ind);
+    sfree(count);
+    sfree(order);
+    return;
+  }
+#endif
+  log.size = 1024;
+  log.v = snewn(log.size, int);
   for (int i=0; i<sz; i++) {
     int x = order[i] % stat->board->width;
     int y = order[i] / stat->board->width;
     char px = ShapePix(stat->board, x, y, 1);
     if (px != ID_UNKNOWN) {
-      SetShapePix(stat->board, x, y, 1, ID_UNKNOWN);
-      for (int k=0, j0=0, n=0; k<stat->conf->numcomp; j0+=n, k++) {
-        n = ShapeDictNum(stat->dict, stat->conf->lev[k]);
-        for (int jk=0; jk<n; jk++) {
-          int nn=0;
-          for (int ii=0; ii<stat->lenposs[j0+jk]; ii++)
-            stat->poss[j0+jk][ii] = 1;
-          mark_inconsistent(stat->board, ShapeDictGet(stat->dict, stat->conf->lev[k], jk), stat->smask[j0+jk], stat->np1[j0+jk], stat->np2[j0+jk], stat->poss[j0+jk]);
-          for (int ii=0; ii<stat->lenposs[j0+jk]; ii++)
-            if (stat->poss[j0+jk][ii])
-              nn++;
-          stat->numposs[j0+jk] = nn;
-        }
-      }
+      prune_restore_pixel(stat, count, x, y, px, ind, &log);
       dict_statistics_constrain_shapes(stat);
       dict_statistics_break_symmetry(stat);
       if (dict_statistics_calc_entropy(stat, COMPLEXITY_LIMIT) != 1) {
         SetShapePix(stat->board, x, y, 1, px);
+        for (int ii=0; ii<log.n; ii+=2) {
+          stat->poss[log.v[ii]][log.v[ii+1]] = 0;
+          count[log.v[ii]]--;
+        }
       }
     }
   }
+  sfree(log.v);
+  sfree(ind);
+  sfree(count);
   sfree(order);
 }
 
@@ -1361,6 +2593,106 @@ ShapeDict* global_dict_m = 0;
 ShapeDict* global_dict_r = 0;
 ShapeDict* global_dict_i = 0;
 
+#ifdef PARALLEL_GENERATION
+
+/*
+ * The computer's next guess in Duel mode only depends on what it knows
+ * about the human's board, which does not change during the human's turn.
+ * So the entropy search for it starts on a private copy of the statistics
+ * when that turn begins, and is collected when the guess is needed. If it
+ * is still not finished after COMPUTER_GUESS_DEADLINE seconds more, it is
+ * stopped and the entropies of the placements counted so far are used.
+ */
+typedef struct ComputerGuess {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  DictStatistics* stat;
+  int stop;     /* Set to end the search */
+  int stopped;  /* Set when the search has ended early */
+  int finished;
+  int done;
+} ComputerGuess;
+
+static int computer_guess_stop(void* ctx)
+{
+  ComputerGuess* cg = (ComputerGuess*)ctx;
+  int res;
+  pthread_mutex_lock(&cg->lock);
+  res = cg->stop;
+  if (res)
+    cg->stopped = 1;
+  pthread_mutex_unlock(&cg->lock);
+  return res;
+}
+
+static void* computer_guess_worker(void* arg)
+{
+  ComputerGuess* cg = (ComputerGuess*)arg;
+  int done = dict_statistics_calc_entropy_until(cg->stat, COMPLEXITY_LIMIT, computer_guess_stop, cg, 0);
+  pthread_mutex_lock(&cg->lock);
+  cg->done = done;
+  cg->finished = 1;
+  pthread_cond_signal(&cg->cond);
+  pthread_mutex_unlock(&cg->lock);
+  return NULL;
+}
+
+static void free_computer_guess(ComputerGuess* cg)
+{
+  pthread_mutex_destroy(&cg->lock);
+  pthread_cond_destroy(&cg->cond);
+  free_dict_statistics(cg->stat);
+  sfree(cg);
+}
+
+ComputerGuess* start_computer_guess(DictStatistics* dstat)
+{
+  ComputerGuess* cg = snew(ComputerGuess);
+  cg->stat = copy_dict_statistics(dstat);
+  /* Its own answer, and no old entropies left if it is stopped early */
+  cg->stat->answer->refcount--;
+  cg->stat->answer = init_shape_answer(dstat->conf);
+  for (int i=0; i<cg->stat->bsize; i++)
+    cg->stat->entr[i] = 0.0;
+  cg->stop = cg->stopped = cg->finished = cg->done = 0;
+  pthread_mutex_init(&cg->lock, NULL);
+  pthread_cond_init(&cg->cond, NULL);
+  if (pthread_create(&cg->thread, NULL, computer_guess_worker, cg)) {
+    free_computer_guess(cg);
+    return 0;
+  }
+  return cg;
+}
+
+int finish_computer_guess(ComputerGuess* cg, DictStatistics* dstat, int deadline)
+{
+  /* Waits at most deadline seconds before stopping the search, and moves
+     the result into dstat unless it is null. Returns as
+     dict_statistics_calc_entropy(), or -2 if the search was stopped. */
+  struct timespec ts;
+  int done;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += deadline;
+  pthread_mutex_lock(&cg->lock);
+  while (!cg->finished && !cg->stop)
+    if (pthread_cond_timedwait(&cg->cond, &cg->lock, &ts) == ETIMEDOUT)
+      cg->stop = 1;
+  pthread_mutex_unlock(&cg->lock);
+  pthread_join(cg->thread, NULL);
+  done = (cg->stopped ? -2 : cg->done);
+  if (dstat) {
+    for (int i=0; i<dstat->bsize; i++)
+      dstat->entr[i] = cg->stat->entr[i];
+    if (done == 1)
+      copy_shape_answer(dstat->answer, cg->stat->answer, dstat->conf);
+  }
+  free_computer_guess(cg);
+  return done;
+}
+
+#endif /* PARALLEL_GENERATION */
+
 /* ---------- Game configuration ---------- */
 
 
@@ -1385,20 +2717,33 @@ struct clues {
   int goal;
   random_state* drs;
   DictStatistics* dstat;
+#ifdef PARALLEL_GENERATION
+  ComputerGuess* cguess; /* The computer's next guess, if started */
+#endif
+};
+
+/*
+ * Each move changes at most a couple of the boards shown, so consecutive
+ * game states share the others. A layer is only copied when a state about
+ * to change it shares it with another state.
+ */
+struct layer {
+  int refcount;
+  Shape* board; /* Squares ON, OFF or UNKNOWN, or pencil marks 0 to 6 */
 };
 
 struct game_state {
   const game_params *par;
   struct clues *clues;
-  char *pencil;
-  Shape* guess;
-  Shape* reveal;
+  struct layer *pencil;
+  struct layer *guess;
+  struct layer *reveal;
   int turn;
   int completed, cheated, errors;
   /* Some extra for Duel mode */
-  char *dpencil;
-  Shape* dguess;
-  Shape* dreveal;
+  struct layer *dpencil;
+  struct layer *dguess;
+  struct layer *dreveal;
   int dturn;
   int dstate; /* prepare, user, computer, only user, only computer, done */
   int dx, dy;
@@ -1642,6 +2987,59 @@ static int shape_config_count(ShapeConfig* conf)
   return sum;
 }
 
+static int shape_config_span(ShapeConfig* conf, ShapeDict* dict)
+{
+  /* Shapes may not touch, not even at a corner, so grown by one cell to the
+     right and down they do not overlap, and fit in the board grown alike.
+     A shape of n cells grown so covers at least n+s+2 cells, where s is the
+     longer side of its bounding box and so at least the root of n. Given
+     the dictionary, the shapes fixed by the fleet are counted exactly. */
+  int sum = 0, s;
+  for (int i=0; i<conf->numcomp; i++) {
+    if (dict && conf->id[i] > -1) {
+      Shape* shape = ShapeDictGet(dict, conf->lev[i], conf->id[i]);
+      const unsigned short* son = ShapeRows(shape, 1);
+      s = 0;
+      for (int r=1; r<shape->height+2; r++)
+        for (unsigned int m = son[r] | son[r-1], g = m | (m<<1); g; g &= g-1)
+          s++;
+      sum += s * conf->mult[i];
+    } else {
+      for (s=1; s*s<conf->lev[i]; s++);
+      sum += (conf->lev[i] + s + 2) * conf->mult[i];
+    }
+  }
+  return sum;
+}
+
+static ShapeDict* params_shape_dictionary(const game_params *params)
+{
+  ShapeDict* dict;
+  if (!global_dict_a) {
+    global_dict_a = init_shape_dictionary(12, ID_REFL_ALL);
+    global_dict_r = init_shape_dictionary(12, ID_REFL_ROT);
+    global_dict_m = init_shape_dictionary(12, ID_REFL_MIR);
+    global_dict_i = init_shape_dictionary(12, ID_REFL_ORIG);
+  }
+  dict = (params->refl == ID_REFL_ALL ? global_dict_a :
+          params->refl == ID_REFL_ROT ? global_dict_r :
+          params->refl == ID_REFL_MIR ? global_dict_m :
+          global_dict_i);
+  extend_shape_dictionary(dict, params->conf->maxlev);
+  return dict;
+}
+
+static ShapeConfig* params_shape_config(const game_params *params)
+{
+  ShapeConfig* conf = copy_shape_config(params->conf);
+  if (params->ftype == 2) { /* standard fleet, only straight line shapes */
+    for (int k=0; k<conf->numcomp; k++)
+      if (conf->id[k] == -1)
+        conf->id[k] = 0;
+  }
+  return conf;
+}
+
 static const char *validate_params(const game_params *params, bool full)
 {
     if (params->bwidth < 3 || params->bwidth > 15 || params->bheight < 3 || params->bheight > 15)
@@ -1653,6 +3051,32 @@ static const char *validate_params(const game_params *params, bool full)
         return "Too dense configuration";
     if (params->conf->maxlev > 12)
         return "Maximum level is 12";
+    if (shape_config_span(params->conf, 0) > (params->bwidth + 1) * (params->bheight + 1))
+        return "Fleet does not fit on the board";
+    if (full) {
+      /* Place the fleet once, so that generating boards for it is known to
+         come to an end */
+      ShapeDict* dict = params_shape_dictionary(params);
+      ShapeConfig* conf = params_shape_config(params);
+      random_state* rs;
+      Shape* board;
+      for (int k=0; k<conf->numcomp; k++)
+        if (conf->lev[k] < 1 || conf->id[k] >= ShapeDictNum(dict, conf->lev[k])) {
+          free_shape_config(conf);
+          return "Unknown shape in configuration";
+        }
+      if (shape_config_span(conf, dict) > (params->bwidth + 1) * (params->bheight + 1)) {
+        free_shape_config(conf);
+        return "Fleet does not fit on the board";
+      }
+      rs = random_new("identifier", 10);
+      board = try_make_random_board(dict, conf, params->bwidth, params->bheight, 0, rs);
+      random_free(rs);
+      free_shape_config(conf);
+      if (!board)
+        return "Fleet could not be placed on the board";
+      free_shape(board);
+    }
     return NULL;
 }
 
@@ -1692,34 +3116,14 @@ static char *new_game_desc(const game_params *params, random_state *rs,
     double entr;
     int x, y, done, count;
     int n, i, off, nc;
-    if (!global_dict_a) {
-      global_dict_a = init_shape_dictionary(12, ID_REFL_ALL);
-      global_dict_r = init_shape_dictionary(12, ID_REFL_ROT);
-      global_dict_m = init_shape_dictionary(12, ID_REFL_MIR);
-      global_dict_i = init_shape_dictionary(12, ID_REFL_ORIG);
-    }
-    dict = (params->refl == ID_REFL_ALL ? global_dict_a :
-            params->refl == ID_REFL_ROT ? global_dict_r :
-            params->refl == ID_REFL_MIR ? global_dict_m :
-            global_dict_i);
-    extend_shape_dictionary(dict, params->conf->maxlev);
-
-    conf = copy_shape_config(params->conf);
-    if (params->ftype == 2) { /* standard fleet, only straight line shapes */
-      for (int k=0; k<conf->numcomp; k++)
-        if (conf->id[k] == -1)
-          conf->id[k] = 0;
-    }
+    dict = params_shape_dictionary(params);
+    conf = params_shape_config(params);
     if (params->mode == 0) {
       while (1) {
-        board = make_random_board(dict, conf, params->bwidth, params->bheight, (params->ftype == 1 ? 1 : 0), rs);
-        if (!board) {
-          if (params->ftype == 1) {
-            free_shape_config(conf);
-            conf = copy_shape_config(params->conf);
-          }
+        /* validate_params placed this fleet, so a board turns up in the end */
+        board = try_make_random_board(dict, conf, params->bwidth, params->bheight, (params->ftype == 1 ? 1 : 0), rs);
+        if (!board)
           continue;
-        }
         done = 0;
         stat = init_dict_statistics(dict, conf, params->bwidth, params->bheight);
         while (1) {
@@ -1738,15 +3142,7 @@ static char *new_game_desc(const game_params *params, random_state *rs,
         }
       }
     } else {
-      while (1) {
-        board = make_random_board(dict, conf, params->bwidth, params->bheight, (params->ftype == 1 ? 1 : 0), rs);
-        if (board)
-          break;
-        else if (params->ftype == 1) {
-          free_shape_config(conf);
-          conf = copy_shape_config(params->conf);
-        }
-      }
+      while (!(board = try_make_random_board(dict, conf, params->bwidth, params->bheight, (params->ftype == 1 ? 1 : 0), rs)));
       if (params->mode == 1) {
         count = 0;
         done = 0;
@@ -1834,6 +3230,57 @@ static const char *validate_desc(const game_params *params, const char *desc)
   return NULL;
 }
 
+static struct layer* new_layer(Shape* board)
+{
+  struct layer* l = snew(struct layer);
+  l->refcount = 1;
+  l->board = board;
+  return l;
+}
+
+static struct layer* share_layer(struct layer* l)
+{
+  if (l)
+    l->refcount++;
+  return l;
+}
+
+static void free_layer(struct layer* l)
+{
+  if (l && --l->refcount <= 0) {
+    free_shape(l->board);
+    sfree(l);
+  }
+}
+
+static Shape* write_layer(struct layer** l)
+{
+  /* The board of a layer about to be changed, unshared first if needed */
+  if ((*l)->refcount > 1) {
+    (*l)->refcount--;
+    *l = new_layer(copy_shape((*l)->board));
+  }
+  return (*l)->board;
+}
+
+static void cancel_computer_guess(struct clues* clues)
+{
+#ifdef PARALLEL_GENERATION
+  if (clues->cguess)
+    finish_computer_guess(clues->cguess, 0, 0);
+  clues->cguess = 0;
+#endif
+}
+
+static void prepare_computer_guess(struct clues* clues)
+{
+  /* Get going on the computer's next guess while the human is thinking */
+#ifdef PARALLEL_GENERATION
+  cancel_computer_guess(clues);
+  clues->cguess = start_computer_guess(clues->dstat);
+#endif
+}
+
 static game_state *new_game(midend *me, const game_params *params, const char *desc)
 {
     int i, n, off;
@@ -1898,24 +3345,22 @@ static game_state *new_game(midend *me, const game_params *params, const char *d
       state->clues->drs = 0;
       state->clues->dstat = 0;
     }
+#ifdef PARALLEL_GENERATION
+    state->clues->cguess = 0;
+#endif
 
-    n = params->bwidth * params->bheight;
-    state->guess = make_empty_board(params->bwidth, params->bheight);
+    state->guess = new_layer(make_empty_board(params->bwidth, params->bheight));
     if (params->mode == 0)
-      state->reveal = copy_shape(state->clues->given);
+      state->reveal = new_layer(copy_shape(state->clues->given));
     else
-      state->reveal = make_empty_board(params->bwidth, params->bheight);
-    state->pencil = snewn(n, char);
-    for (i = 0; i < n; i++) {
-        state->pencil[i] = 0;
-    }
+      state->reveal = new_layer(make_empty_board(params->bwidth, params->bheight));
+    state->pencil = new_layer(make_empty_board(params->bwidth, params->bheight));
+    reset_board(state->pencil->board, 0);
     if (params->mode == 2) {
-      state->dguess = make_empty_board(params->bwidth, params->bheight);
-      state->dreveal = make_empty_board(params->bwidth, params->bheight);
-      state->dpencil = snewn(n, char);
-      for (i = 0; i < n; i++) {
-        state->dpencil[i] = 0;
-      }
+      state->dguess = new_layer(make_empty_board(params->bwidth, params->bheight));
+      state->dreveal = new_layer(make_empty_board(params->bwidth, params->bheight));
+      state->dpencil = new_layer(make_empty_board(params->bwidth, params->bheight));
+      reset_board(state->dpencil->board, 0);
       state->dstate = 0;
     } else {
       state->dguess = 0;
@@ -1934,31 +3379,17 @@ static game_state *new_game(midend *me, const game_params *params, const char *d
 static game_state *dup_game(const game_state *state)
 {
     game_state *ret = snew(game_state);
-    int i, n;
 
     ret->par = state->par;
     ret->clues = state->clues;
     ret->clues->refcount++;
 
-    n = state->par->bwidth * state->par->bheight;
-    ret->guess = copy_shape(state->guess);
-    ret->reveal = copy_shape(state->reveal);
-    ret->pencil = snewn(n, char);
-    for (i = 0; i < n; i++) {
-        ret->pencil[i] = state->pencil[i];
-    }
-    if (state->par->mode == 2) {
-      ret->dguess = copy_shape(state->dguess);
-      ret->dreveal = copy_shape(state->dreveal);
-      ret->dpencil = snewn(n, char);
-      for (i = 0; i < n; i++) {
-        ret->dpencil[i] = state->dpencil[i];
-      }
-    } else {
-      ret->dguess = 0;
-      ret->dreveal = 0;
-      ret->dpencil = 0;
-    }
+    ret->guess = share_layer(state->guess);
+    ret->reveal = share_layer(state->reveal);
+    ret->pencil = share_layer(state->pencil);
+    ret->dguess = share_layer(state->dguess);
+    ret->dreveal = share_layer(state->dreveal);
+    ret->dpencil = share_layer(state->dpencil);
     ret->turn = state->turn;
     ret->dturn = state->dturn;
     ret->dstate = state->dstate;
@@ -1980,19 +3411,18 @@ static void free_game(game_state *state)
           free_shape(state->clues->given);
         if (state->clues->drs)
           random_free(state->clues->drs);
+        cancel_computer_guess(state->clues);
         if (state->clues->dstat)
           free_dict_statistics(state->clues->dstat);
         free_shape_config(state->clues->conf);
         sfree(state->clues);
     }
-    free_shape(state->guess);
-    free_shape(state->reveal);
-    sfree(state->pencil);
-    if (state->dpencil) {
-      free_shape(state->dguess);
-      free_shape(state->dreveal);
-      sfree(state->dpencil);
-    }
+    free_layer(state->guess);
+    free_layer(state->reveal);
+    free_layer(state->pencil);
+    free_layer(state->dguess);
+    free_layer(state->dreveal);
+    free_layer(state->dpencil);
     sfree(state);
 }
 
@@ -2058,7 +3488,7 @@ struct game_drawstate {
 
 static int check_can_guess(const game_state* state)
 {
-  return shape_config_count(state->par->conf) == count_board(state->guess, ID_ON) + count_board(state->reveal, ID_ON);
+  return shape_config_count(state->par->conf) == count_board(state->guess->board, ID_ON) + count_board(state->reveal->board, ID_ON);
 }
 
 static char *interpret_move(const game_state *state, game_ui *ui, const game_drawstate *ds,
@@ -2082,9 +3512,9 @@ static char *interpret_move(const game_state *state, game_ui *ui, const game_dra
       ui->hcursor = 0;
       if (ui->hpanel == 1 && tx == ui->hx && ty == ui->hy && ui->hshow) {
         /* button-click on the already active square */
-        if (ShapePix(state->reveal, ui->hx, ui->hy, 1) != ID_UNKNOWN)
+        if (ShapePix(state->reveal->board, ui->hx, ui->hy, 1) != ID_UNKNOWN)
           return retstr;
-        pix = ShapePix(state->guess, ui->hx, ui->hy, 1);
+        pix = ShapePix(state->guess->board, ui->hx, ui->hy, 1);
         if (button == LEFT_BUTTON)
           sprintf(buf, "Tn%d,%d,%d", ui->hx, ui->hy, (pix==ID_ON ? 2 : pix==ID_OFF ? 0 : 1));
         else
@@ -2102,9 +3532,9 @@ static char *interpret_move(const game_state *state, game_ui *ui, const game_dra
       ui->hcursor = 0;
       if (ui->hpanel == 2 && tx == ui->hx && ty == ui->hy && ui->hshow) {
         /* button-click on the already active square */
-        if (ShapePix(state->dreveal, ui->hx, ui->hy, 1) != ID_UNKNOWN)
+        if (ShapePix(state->dreveal->board, ui->hx, ui->hy, 1) != ID_UNKNOWN)
           return retstr;
-        pix = ShapePix(state->dguess, ui->hx, ui->hy, 1);
+        pix = ShapePix(state->dguess->board, ui->hx, ui->hy, 1);
         if (button == LEFT_BUTTON)
           sprintf(buf, "Td%d,%d,%d", ui->hx, ui->hy, (pix==ID_ON ? 2 : pix==ID_OFF ? 0 : 1));
         else
@@ -2141,17 +3571,17 @@ static char *interpret_move(const game_state *state, game_ui *ui, const game_dra
 
   if (button == CURSOR_SELECT2 || button == '\b') {
     if (state->dstate == 2 || state->dstate == 6) {
-      pix = ShapePix(state->dguess, state->dx, state->dy, 1);
+      pix = ShapePix(state->dguess->board, state->dx, state->dy, 1);
       sprintf(buf, "Td%d,%d,%d", state->dx, state->dy, (pix==ID_ON ? 2 : pix==ID_OFF ? 0 : 1));
     } else if (ui->hpanel == 2 && ui->hshow) {
-      if (ShapePix(state->reveal, ui->hx, ui->hy, 1) != ID_UNKNOWN)
+      if (ShapePix(state->reveal->board, ui->hx, ui->hy, 1) != ID_UNKNOWN)
         return retstr;
-      pix = ShapePix(state->dguess, ui->hx, ui->hy, 1);
+      pix = ShapePix(state->dguess->board, ui->hx, ui->hy, 1);
       sprintf(buf, "Td%d,%d,%d", ui->hx, ui->hy, (pix==ID_ON ? 2 : pix==ID_OFF ? 0 : 1));
     } else if (ui->hpanel == 1 && ui->hshow) {
-      if (ShapePix(state->reveal, ui->hx, ui->hy, 1) != ID_UNKNOWN)
+      if (ShapePix(state->reveal->board, ui->hx, ui->hy, 1) != ID_UNKNOWN)
         return retstr;
-      pix = ShapePix(state->guess, ui->hx, ui->hy, 1);
+      pix = ShapePix(state->guess->board, ui->hx, ui->hy, 1);
       sprintf(buf, "Tn%d,%d,%d", ui->hx, ui->hy, (pix==ID_ON ? 2 : pix==ID_OFF ? 0 : 1));
     } else
       return retstr;
@@ -2160,14 +3590,14 @@ static char *interpret_move(const game_state *state, game_ui *ui, const game_dra
 
   if (button == CURSOR_SELECT) {
     if (state->dstate == 2 || state->dstate == 6) {
-      pix = ShapePix(state->dguess, state->dx, state->dy, 1);
+      pix = ShapePix(state->dguess->board, state->dx, state->dy, 1);
       if (pix==ID_ON || pix==ID_OFF) {
         sprintf(buf, "R%d,%d,%d", state->dx, state->dy, (pix==ID_ON ? 1 : 2));
         return dupstr(buf);
       }
     } else if (ui->hpanel == 1 && ui->hshow && state->dstate != 0 && state->par->mode != 0) {
       if (!ui->hcursor) ui->hshow = 0;
-      if (ShapePix(state->reveal, ui->hx, ui->hy, 1) == ID_UNKNOWN) {
+      if (ShapePix(state->reveal->board, ui->hx, ui->hy, 1) == ID_UNKNOWN) {
         sprintf(buf, "Q%d,%d", ui->hx, ui->hy);
         return dupstr(buf);
       }
@@ -2197,11 +3627,30 @@ static char *interpret_move(const game_state *state, game_ui *ui, const game_dra
 static void execute_computer_guess(game_state* ret)
 {
   double entr;
-  int x, y;
-  int done = dict_statistics_calc_entropy(ret->clues->dstat, COMPLEXITY_LIMIT);
+  int x, y, done;
+#ifdef PARALLEL_GENERATION
+  DictStatistics* dstat = ret->clues->dstat;
+  if (!ret->clues->cguess)
+    ret->clues->cguess = start_computer_guess(dstat);
+  if (ret->clues->cguess) {
+    done = finish_computer_guess(ret->clues->cguess, dstat, COMPUTER_GUESS_DEADLINE);
+    ret->clues->cguess = 0;
+  } else
+    done = dict_statistics_calc_entropy(dstat, COMPLEXITY_LIMIT);
+  if (done == -2) {
+    /* Stopped at the deadline, so estimate the entropies by sampling, or
+       else go with the partial ones unless there is nothing to pick */
+    int i;
+    dict_statistics_sample_entropy(dstat, INT_MAX, 0.0, COMPUTER_GUESS_SAMPLE_TIME, ret->clues->drs, 0, 0);
+    for (i=0; i<dstat->bsize && dstat->entr[i] <= 0.0; i++);
+    done = (i<dstat->bsize ? 0 : dict_statistics_calc_entropy(dstat, COMPLEXITY_LIMIT));
+  }
+#else
+  done = dict_statistics_calc_entropy(ret->clues->dstat, COMPLEXITY_LIMIT);
+#endif
   if (done) {
     dict_statistics_fill_board(ret->clues->dstat);
-    copy_board(ret->clues->dstat->board, ret->dreveal);
+    copy_board(ret->clues->dstat->board, write_layer(&ret->dreveal));
     ret->dstate = (ret->dstate == 1 ? 5 : 4);
   } else {
     dict_statistics_pick_best_entropy(ret->clues->dstat, 0, 0, ret->clues->drs, &entr, &x, &y);
@@ -2222,17 +3671,20 @@ static game_state *execute_move(const game_state *from0, const char *move)
     int w = from->par->bwidth;
     int h = from->par->bheight;
     game_state *ret;
+    Shape *guess, *reveal;
     char ch;
     int x, y, n;
     if (move[0] == 'S') {
 	ret = dup_game(from);
 	ret->completed = ret->cheated = true;
         ret->errors = false;
+        reveal = write_layer(&ret->reveal);
+        guess = write_layer(&ret->guess);
 	for (x = 0; x < w; x++)
           for (y = 0; y < h; y++) {
             ch = ShapePix(ret->clues->groundtruth, x, y, 1);
-            SetShapePix(ret->reveal, x, y, 1, ch);
-            SetShapePix(ret->guess, x, y, 1, ID_UNKNOWN);
+            SetShapePix(reveal, x, y, 1, ch);
+            SetShapePix(guess, x, y, 1, ID_UNKNOWN);
           }
         ret->dstate = (ret->dstate == 5 ? 4 : 6);
         if (ret->dstate == 6)
@@ -2243,26 +3695,27 @@ static game_state *execute_move(const game_state *from0, const char *move)
 	x >= 0 && x < w && y >= 0 && y < h && n >= 0 && n <= 2) {
 	ret = dup_game(from);
         if (move[1] == 'd') 
-          SetShapePix(ret->dguess, x, y, 1, (n==1 ? ID_ON : n==2 ? ID_OFF : ID_UNKNOWN));
+          SetShapePix(write_layer(&ret->dguess), x, y, 1, (n==1 ? ID_ON : n==2 ? ID_OFF : ID_UNKNOWN));
         else
-          SetShapePix(ret->guess, x, y, 1, (n==1 ? ID_ON : n==2 ? ID_OFF : ID_UNKNOWN));
+          SetShapePix(write_layer(&ret->guess), x, y, 1, (n==1 ? ID_ON : n==2 ? ID_OFF : ID_UNKNOWN));
 	return ret;
     } else if (move[0] == 'P' &&
 	sscanf(move+2, "%d,%d,%d", &x, &y, &n) == 3 &&
 	x >= 0 && x < w && y >= 0 && y < h && n >= 0 && n <= 6) {
 	ret = dup_game(from);
         if (move[1] == 'd') 
-          ret->dpencil[y*w + x] = (char)n;
+          SetShapePix(write_layer(&ret->dpencil), x, y, 1, (char)n);
         else
-          ret->pencil[y*w + x] = (char)n;
+          SetShapePix(write_layer(&ret->pencil), x, y, 1, (char)n);
 	return ret;
     } else if (move[0] == 'Q' &&
 	sscanf(move+1, "%d,%d", &x, &y) == 2 &&
 	x >= 0 && x < w && y >= 0 && y < h) {
 	ret = dup_game(from);
         ch = ShapePix(ret->clues->groundtruth, x, y, 1);
-        SetShapePix(ret->reveal, x, y, 1, ch);
-        SetShapePix(ret->guess, x, y, 1, ID_UNKNOWN);
+        SetShapePix(write_layer(&ret->reveal), x, y, 1, ch);
+        if (ShapePix(ret->guess->board, x, y, 1) != ID_UNKNOWN)
+          SetShapePix(write_layer(&ret->guess), x, y, 1, ID_UNKNOWN);
         ret->turn += 1;
         if (ret->turn == w*h) {
           ret->completed = true;
@@ -2277,12 +3730,15 @@ static game_state *execute_move(const game_state *from0, const char *move)
 	x >= 0 && x < w && y >= 0 && y < h && n >= 1 && n <= 2) {
       if (from->par->mode == 2 && (from->dstate == 2 || from->dstate == 6)) {
         ret = dup_game(from);
-        SetShapePix(ret->dreveal, x, y, 1, (n==1 ? ID_ON : ID_OFF));
+        SetShapePix(write_layer(&ret->dreveal), x, y, 1, (n==1 ? ID_ON : ID_OFF));
         ret->dturn += 1;
+        cancel_computer_guess(ret->clues);
         dict_statistics_update_poss(ret->clues->dstat, x, y, (n==1 ? ID_ON : ID_OFF));
         ret->dstate = (ret->dstate == 2 ? 1 : 6);
         if (ret->dstate == 6)
           execute_computer_guess(ret);
+        else
+          prepare_computer_guess(ret->clues);
         return ret;
       } else
         return from;
@@ -2290,16 +3746,18 @@ static game_state *execute_move(const game_state *from0, const char *move)
       int err = 0;
       ret = dup_game(from);
       ret->completed = true;
+      guess = write_layer(&ret->guess);
+      reveal = write_layer(&ret->reveal);
       for (x = 0; x < w; x++)
         for (y = 0; y < h; y++) {
           ch = ShapePix(ret->clues->groundtruth, x, y, 1);
-          if (ShapePix(ret->guess, x, y, 1) == ID_UNKNOWN)
-            SetShapePix(ret->guess, x, y, 1, (ShapePix(ret->reveal, x, y, 1) == ID_ON ? ID_ON : ID_OFF));
-          if (ShapePix(ret->guess, x, y, 1) != ch)
+          if (ShapePix(guess, x, y, 1) == ID_UNKNOWN)
+            SetShapePix(guess, x, y, 1, (ShapePix(reveal, x, y, 1) == ID_ON ? ID_ON : ID_OFF));
+          if (ShapePix(guess, x, y, 1) != ch)
             err = 1;
           else
-            SetShapePix(ret->guess, x, y, 1, ID_UNKNOWN);
-          SetShapePix(ret->reveal, x, y, 1, ch);
+            SetShapePix(guess, x, y, 1, ID_UNKNOWN);
+          SetShapePix(reveal, x, y, 1, ch);
         }
       ret->errors = (err ? true : false);
       ret->dstate = (ret->dstate == 5 ? 4 : 6);
@@ -2310,6 +3768,7 @@ static game_state *execute_move(const game_state *from0, const char *move)
       if (from->par->mode == 2 && from->dstate == 0) {
         ret = dup_game(from);
         ret->dstate = 1;
+        prepare_computer_guess(ret->clues);
         return ret;
       } else
         return from;
@@ -2618,7 +4077,7 @@ static void game_redraw(drawing *dr, game_drawstate *ds, const game_state *oldst
     if (state->par->mode == 2) {
       for (k = 0, y = 0; y < h; y++) {
 	for (x = 0; x < w; x++, k++) {
-          draw_tile(dr, ds, state->par, 1, x, y, state->dreveal, state->dguess, state->dpencil[k],
+          draw_tile(dr, ds, state->par, 1, x, y, state->dreveal->board, state->dguess->board, ShapePix(state->dpencil->board, x, y, 1),
                     ((state->dstate == 2 || state->dstate == 6) ?
                      (state->dx == x && state->dy == y ? 1 : 0) :
                      (ui->hpanel == 2 && ui->hshow && ui->hx == x && ui->hy == y ? 1 : 0)),
@@ -2641,7 +4100,7 @@ static void game_redraw(drawing *dr, game_drawstate *ds, const game_state *oldst
 
     for (k = 0, y = 0; y < h; y++) {
       for (x = 0; x < w; x++, k++) {
-        draw_tile(dr, ds, state->par, 0, x, y, state->reveal, state->guess, state->pencil[k],
+        draw_tile(dr, ds, state->par, 0, x, y, state->reveal->board, state->guess->board, ShapePix(state->pencil->board, x, y, 1),
                   ((state->dstate == 2 || state->dstate == 6) ? 0 :
                    (ui->hpanel == 1 && ui->hshow && ui->hx == x && ui->hy == y ? 1 : 0)),
                   (state->completed && state->errors ? 1 : 0),
@@ -16,6 +16,7 @@
 
 #define MAXCOORD 4
 #define MAXDOMAIN 6
+#define LONGBITS (8*(int)sizeof(unsigned long))
 
 typedef enum { Basic, Tandem, ThreeD, Floors, Keys, Levers, Combo }  SmStyle;
 
@@ -380,15 +381,23 @@ typedef enum { Impossible, Open, Closed, Unset }  SmPowerDoor;
 
 typedef enum { Unallocated, Connected, Island, Complete } SmRoomStatus;
 
-typedef struct SmPowerRoom {
+/* The power-state graph, in flat arrays indexed by state (see getindex).
+   Every state has exactly ndoors door slots, so its row in trans, door
+   and recdir starts at ind*ndoors; trans holds the neighbouring state, or
+   -1 where the door is Impossible. */
+typedef struct SmPowerGraph {
+  int num;
+  int ncoord;
+  int ndoors;
   int* coord;
-  struct SmPowerRoom** trans;
-  SmPowerDoor* door;
-  int* recdir;
-  SmRoomStatus status;
-  int domain;
-  int dist;
-} SmPowerRoom;
+  int* trans;
+  unsigned char* door;    /* SmPowerDoor */
+  signed char* recdir;
+  unsigned char* status;  /* SmRoomStatus */
+  signed char* domain;
+  int* dist;
+  unsigned long* seen;    /* Bitset of the rooms with dist set */
+} SmPowerGraph;
 
 typedef struct SuperMaze {
   int size;
@@ -1213,134 +1222,154 @@ static float uniform(random_state *rs)
   return (random_bits(rs, 22) / (float)(1<<22));
 }
 
-static int bottleneckscore(SmPowerRoom* rstate, int dir)
+static int* roomcoord(SmPowerGraph* g, int r)
 {
-  return (rstate->dist + 1)*(rstate->trans[dir]->dist + 1);
+  return g->coord + r*g->ncoord;
 }
 
+static int bottleneckscore(SmPowerGraph* g, int r, int dir)
+{
+  return (g->dist[r] + 1)*(g->dist[g->trans[r*g->ndoors + dir]] + 1);
+}
 
 
-static void floodfillisland(SmPowerRoom* rstate, int dom, int ndoors, SmPowerRoom** pool, int* numpool)
+
+static void floodfillisland(SmPowerGraph* g, int r, int dom, int* pool, int* numpool)
 {
-  int j;
+  int j, t;
+  int nd = g->ndoors;
   int startpool = *numpool;
-  rstate->status = Connected;
-  rstate->domain = dom;
-  pool[*numpool] = rstate;
+  g->status[r] = Connected;
+  g->domain[r] = dom;
+  pool[*numpool] = r;
   *numpool += 1;
   while (startpool < *numpool) {
-    rstate = pool[startpool];
-    for (j=0; j<ndoors; j++) 
-      if (rstate->door[j] == Open && rstate->trans[j]->status == Island) {
-        rstate->trans[j]->status = Connected;
-        rstate->trans[j]->domain = dom;
-        pool[*numpool] = rstate->trans[j];
+    r = pool[startpool];
+    for (j=0; j<nd; j++) {
+      t = g->trans[r*nd + j];
+      if (g->door[r*nd + j] == Open && g->status[t] == Island) {
+        g->status[t] = Connected;
+        g->domain[t] = dom;
+        pool[*numpool] = t;
         *numpool += 1;
       }
+    }
     startpool++;
   }
 }
 
-static int canopendoor(const game_params *params, SmPowerRoom** states, SmPowerRoom* rstate, int dir)
+static int canopendoor(const game_params *params, SmPowerGraph* g, int r, int dir)
 {
   /* This is called to see if we can open an Unset door. What can prevent this is
      that we have bottlenecks and this would open up between two different domains
      (directly or in any mirror). */
-  int i, n, *ms, *md;
-  n = getmirrordoors(params, rstate->coord, dir, &ms, &md);
-  for (i=0; i<n; i++)
-    if (states[ms[i]]->status == Connected &&
-        states[ms[i]]->trans[md[i]]->status == Connected &&
-        states[ms[i]]->domain != states[ms[i]]->trans[md[i]]->domain)
+  int i, n, s, t, *ms, *md;
+  n = getmirrordoors(params, roomcoord(g, r), dir, &ms, &md);
+  for (i=0; i<n; i++) {
+    s = ms[i];
+    if (g->status[s] != Connected)
+      continue;
+    t = g->trans[s*g->ndoors + md[i]];
+    if (g->status[t] == Connected && g->domain[s] != g->domain[t])
       return 0;
+  }
   return 1;
 }
 
-static void opendoor(const game_params *params, SmPowerRoom** states, SmPowerRoom* rstate, int dir, int ndoors, SmPowerRoom** pool, int* numpool)
+static void opendoor(const game_params *params, SmPowerGraph* g, int r, int dir, int* pool, int* numpool)
 {
-  int i, j, c1, c2, nm, nc, *ms, *md, *cs, *cd;
-  nm = getmirrordoors(params, rstate->coord, dir, &ms, &md);
+  int i, j, s, t, c1, c2, nm, nc, *ms, *md, *cs, *cd;
+  int nd = g->ndoors;
+  nm = getmirrordoors(params, roomcoord(g, r), dir, &ms, &md);
   for (i=0; i<nm; i++) {
-    states[ms[i]]->door[md[i]] = Open;
-    states[ms[i]]->trans[md[i]]->door[states[ms[i]]->recdir[md[i]]] = Open;
-    c1 = (states[ms[i]]->status == Complete || states[ms[i]]->status == Connected);
-    c2 = (states[ms[i]]->trans[md[i]]->status == Complete || states[ms[i]]->trans[md[i]]->status == Connected);
+    s = ms[i];
+    t = g->trans[s*nd + md[i]];
+    g->door[s*nd + md[i]] = Open;
+    g->door[t*nd + g->recdir[s*nd + md[i]]] = Open;
+    c1 = (g->status[s] == Complete || g->status[s] == Connected);
+    c2 = (g->status[t] == Complete || g->status[t] == Connected);
     /* Fix the mirror states. */
     if (c1 && c2) {
     } else if (c1 || c2) {
       /* One is connected, connect and domain-tag the other */
       if (c1) {
-        rstate = states[ms[i]];
+        r = s;
         dir = md[i];
       } else {
-        int tmp = md[i];
-        dir = states[ms[i]]->recdir[tmp];
-        rstate = states[ms[i]]->trans[tmp];
+        dir = g->recdir[s*nd + md[i]];
+        r = t;
       }
-      if (rstate->trans[dir]->status == Unallocated) {
-        rstate->trans[dir]->status = Connected;
-        rstate->trans[dir]->domain = rstate->domain;
-        pool[*numpool] = rstate->trans[dir];
+      t = g->trans[r*nd + dir];
+      if (g->status[t] == Unallocated) {
+        g->status[t] = Connected;
+        g->domain[t] = g->domain[r];
+        pool[*numpool] = t;
         *numpool += 1;
-      } else if (rstate->trans[dir]->status == Island) {
+      } else if (g->status[t] == Island) {
         /* Flood fill with Connected and domain */
-        floodfillisland(rstate->trans[dir], rstate->domain, ndoors, pool, numpool);
+        floodfillisland(g, t, g->domain[r], pool, numpool);
       }
     } else {
       /* Make an island */
-      states[ms[i]]->status = Island;
-      states[ms[i]]->trans[md[i]]->status = Island;
+      g->status[s] = Island;
+      g->status[t] = Island;
     }
   }
 
-  nc = getcontradoors(params, rstate->coord, dir, &cs, &cd);
+  nc = getcontradoors(params, roomcoord(g, r), dir, &cs, &cd);
   for (j=0; j<nc; j++)
-    if (states[cs[j]]->door[cd[j]] != Closed) {
-      nm = getmirrordoors(params, states[cs[j]]->coord, cd[j], &ms, &md);
+    if (g->door[cs[j]*nd + cd[j]] != Closed) {
+      nm = getmirrordoors(params, roomcoord(g, cs[j]), cd[j], &ms, &md);
       for (i=0; i<nm; i++) {
-        states[ms[i]]->door[md[i]] = Closed;
-        states[ms[i]]->trans[md[i]]->door[states[ms[i]]->recdir[md[i]]] = Closed;
+        s = ms[i];
+        g->door[s*nd + md[i]] = Closed;
+        g->door[g->trans[s*nd + md[i]]*nd + g->recdir[s*nd + md[i]]] = Closed;
       }
     }
 }
 
-static void closedoor(const game_params *params, SmPowerRoom** states, SmPowerRoom* rstate, int dir)
+static void closedoor(const game_params *params, SmPowerGraph* g, int r, int dir)
 {
-  int i, n, *ms, *md;
-  n = getmirrordoors(params, rstate->coord, dir, &ms, &md);
+  int i, n, s, *ms, *md;
+  int nd = g->ndoors;
+  n = getmirrordoors(params, roomcoord(g, r), dir, &ms, &md);
   for (i=0; i<n; i++) {
-    states[ms[i]]->door[md[i]] = Closed;
-    states[ms[i]]->trans[md[i]]->door[states[ms[i]]->recdir[md[i]]] = Closed;
+    s = ms[i];
+    g->door[s*nd + md[i]] = Closed;
+    g->door[g->trans[s*nd + md[i]]*nd + g->recdir[s*nd + md[i]]] = Closed;
   }
 }
 
-static int canbreakupdoor(const game_params *params, SmPowerRoom** states, SmPowerRoom* rstate, int dir, int* dom)
+static int canbreakupdoor(const game_params *params, SmPowerGraph* g, int r, int dir, int* dom)
 {
-  int i, j, n, c1, c2, ok, nm, nc, *ms, *md, *cs, *cd, *numdom;
-  if (rstate->door[dir] != Closed)
+  int i, j, n, s, t, c1, c2, ok, nm, nc, *ms, *md, *cs, *cd, *numdom;
+  int nd = g->ndoors;
+  if (g->door[r*nd + dir] != Closed)
     return 0;
 
-  nc = getcontradoors(params, rstate->coord, dir, &cs, &cd);
+  nc = getcontradoors(params, roomcoord(g, r), dir, &cs, &cd);
   for (j=0; j<nc; j++)
-    if (states[cs[j]]->door[cd[j]] == Open)
+    if (g->door[cs[j]*nd + cd[j]] == Open)
       return 0;
-    else if (states[cs[j]]->door[cd[j]] == Unset)
+    else if (g->door[cs[j]*nd + cd[j]] == Unset)
       break;
 
   numdom = snewn(MAXDOMAIN+1, int);
   for (i=0; i<MAXDOMAIN+1; i++)
     numdom[i] = 0;
   ok = 0;
-  nm = getmirrordoors(params, rstate->coord, dir, &ms, &md);
+  nm = getmirrordoors(params, roomcoord(g, r), dir, &ms, &md);
   for (i=0; i<nm; i++) {
-    c1 = (states[ms[i]]->status == Complete || states[ms[i]]->status == Connected);
-    c2 = (states[ms[i]]->trans[md[i]]->status == Complete || states[ms[i]]->trans[md[i]]->status == Connected);
-    if (c1 && c2 && states[ms[i]]->domain != states[ms[i]]->trans[md[i]]->domain) {
+    s = ms[i];
+    t = g->trans[s*nd + md[i]];
+    c1 = (g->status[s] == Complete || g->status[s] == Connected);
+    c2 = (g->status[t] == Complete || g->status[t] == Connected);
+    if (c1 && c2 && g->domain[s] != g->domain[t]) {
       sfree(numdom);
       return 0; /* There should be no transition between different domains */
     }
     if (c1 ^ c2) { /* There exist a transition between conn and non-conn */
-      numdom[c1 ? states[ms[i]]->domain : states[ms[i]]->trans[md[i]]->domain]++;
+      numdom[c1 ? g->domain[s] : g->domain[t]]++;
       ok = 1;
     }
   }
@@ -1359,44 +1388,47 @@ static int canbreakupdoor(const game_params *params, SmPowerRoom** states, SmPow
   return ok;
 }
 
-static int canbreakupdoor_conn(const game_params *params, SmPowerRoom** states, SmPowerRoom* rstate, int dir, int* score, int* dom1, int* dom2)
+static int canbreakupdoor_conn(const game_params *params, SmPowerGraph* g, int r, int dir, int* score, int* dom1, int* dom2)
 {
-  int i, j, nm, nc, *ms, *md, *cs, *cd;
+  int i, j, s, t, nm, nc, *ms, *md, *cs, *cd;
   int d1, d2, c1, c2;
   int minscore, tmpscore;
-  if (rstate->door[dir] != Closed) {
+  int nd = g->ndoors;
+  if (g->door[r*nd + dir] != Closed) {
     *score = -1;
     return 0;
   }
 
-  nc = getcontradoors(params, rstate->coord, dir, &cs, &cd);
+  nc = getcontradoors(params, roomcoord(g, r), dir, &cs, &cd);
   for (j=0; j<nc; j++)
-    if (states[cs[j]]->door[cd[j]] == Open) {
+    if (g->door[cs[j]*nd + cd[j]] == Open) {
       *score = -1;
       return 0;
-    } else if (states[cs[j]]->door[cd[j]] == Unset)
+    } else if (g->door[cs[j]*nd + cd[j]] == Unset)
       break;
 
   d1 = d2 = -1;
   minscore = -1;
-  nm = getmirrordoors(params, rstate->coord, dir, &ms, &md);
+  nm = getmirrordoors(params, roomcoord(g, r), dir, &ms, &md);
   for (i=0; i<nm; i++) {
-    c1 = (states[ms[i]]->status == Complete || states[ms[i]]->status == Connected);
-    c2 = (states[ms[i]]->trans[md[i]]->status == Complete || states[ms[i]]->trans[md[i]]->status == Connected);
+    s = ms[i];
+    t = g->trans[s*nd + md[i]];
+    c1 = (g->status[s] == Complete || g->status[s] == Connected);
+    c2 = (g->status[t] == Complete || g->status[t] == Connected);
     if (c1 != c2) { /* do not create new reachable states */
       *score = -1;
       return 0;
-    } else if (c1 && c2 && states[ms[i]]->domain != states[ms[i]]->trans[md[i]]->domain) {
+    } else if (c1 && c2 && g->domain[s] != g->domain[t]) {
       if (d1 == -1) {
-        d1 = states[ms[i]]->domain;
-        d2 = states[ms[i]]->trans[md[i]]->domain;
-        minscore = bottleneckscore(states[ms[i]], md[i]);
-      } else if ((states[ms[i]]->domain != d1 && states[ms[i]]->domain != d2) ||    
-                 (states[ms[i]]->trans[md[i]]->domain != d1 && states[ms[i]]->trans[md[i]]->domain != d2)) {  /* and no other domains involved */
+        d1 = g->domain[s];
+        d2 = g->domain[t];
+        minscore = bottleneckscore(g, s, md[i]);
+      } else if ((g->domain[s] != d1 && g->domain[s] != d2) ||    
+                 (g->domain[t] != d1 && g->domain[t] != d2)) {  /* and no other domains involved */
         *score = -1;
         return 0;
       } else {
-        tmpscore = bottleneckscore(states[ms[i]], md[i]);
+        tmpscore = bottleneckscore(g, s, md[i]);
         if (tmpscore < minscore)
           minscore = tmpscore;
       }
@@ -1408,50 +1440,93 @@ static int canbreakupdoor_conn(const game_params *params, SmPowerRoom** states,
   return (d1<=0 || d2<=0 ? 0 : 1);
 }
 
-static int calcdistance(SmPowerRoom** pool, int npool, int ndoors)
+/* Breadth first search from the rooms in pool through Open doors among the
+   first ndoors directions, setting dist in rooms not yet reached since the
+   last cleardistance(). The pool is the queue and must have room for all
+   states. Visited rooms are marked in the seen bitset, which is denser to
+   test than dist. */
+static int calcdistance(SmPowerGraph* g, int* pool, int npool, int ndoors)
 {
-  int start, end, max, j;
+  int start, end, level, j, r, t;
+  int nd = g->ndoors;
+  unsigned long* seen = g->seen;
+  for (j=0; j<npool; j++) {
+    g->dist[pool[j]] = 0;
+    seen[pool[j]/LONGBITS] |= 1UL << (pool[j]%LONGBITS);
+  }
   start = 0;
   end = npool;
-  for (j=0; j<npool; j++)
-    pool[j]->dist = 0;
-  max = 0;
-  while (start < end) {
-    for (j=0; j<ndoors; j++) {
-      if (pool[start]->door[j] == Open && pool[start]->trans[j]->dist == -1) {
-        pool[start]->trans[j]->dist = pool[start]->dist + 1;
-        if (pool[start]->trans[j]->dist > max) max = pool[start]->trans[j]->dist;
-        pool[end++] = pool[start]->trans[j];
+  for (level=0; ; level++) {
+    npool = end;
+    for (; start < npool; start++) {
+      r = pool[start];
+      for (j=0; j<ndoors; j++) {
+        t = g->trans[r*nd + j];
+        if (g->door[r*nd + j] == Open && !((seen[t/LONGBITS] >> (t%LONGBITS)) & 1)) {
+          seen[t/LONGBITS] |= 1UL << (t%LONGBITS);
+          g->dist[t] = level + 1;
+          pool[end++] = t;
+        }
       }
     }
-    start++;
+    if (end == npool)
+      return level;
   }
-  return max;
 }
 
-static void free_powerstates(SmPowerRoom** states, const game_params *params)
+static void cleardistance(SmPowerGraph* g)
 {
-  int i, num;
-  num = numindex(params);
-  for (i=0; i<num; i++) {
-    sfree(states[i]->coord);
-    sfree(states[i]->trans);
-    sfree(states[i]->door);
-    sfree(states[i]->recdir);
-    sfree(states[i]);
+  int i;
+  for (i=0; i<g->num; i++)
+    g->dist[i] = -1;
+  memset(g->seen, 0, ((g->num + LONGBITS - 1) / LONGBITS) * sizeof(unsigned long));
+}
+
+static SmPowerGraph* new_powerstates(const game_params *params)
+{
+  int i;
+  SmPowerGraph* g = snew(SmPowerGraph);
+  g->num = numindex(params);
+  g->ncoord = numcoord(params);
+  g->ndoors = numdoors(params);
+  g->coord = snewn(g->num*g->ncoord, int);
+  g->trans = snewn(g->num*g->ndoors, int);
+  g->door = snewn(g->num*g->ndoors, unsigned char);
+  g->recdir = snewn(g->num*g->ndoors, signed char);
+  g->status = snewn(g->num, unsigned char);
+  g->domain = snewn(g->num, signed char);
+  g->dist = snewn(g->num, int);
+  g->seen = snewn((g->num + LONGBITS - 1) / LONGBITS, unsigned long);
+  for (i=0; i<g->num; i++) {
+    g->status[i] = Unallocated;
+    g->domain[i] = -1;
   }
-  sfree(states);
+  return g;
+}
+
+static void free_powerstates(SmPowerGraph* g)
+{
+  sfree(g->coord);
+  sfree(g->trans);
+  sfree(g->door);
+  sfree(g->recdir);
+  sfree(g->status);
+  sfree(g->domain);
+  sfree(g->dist);
+  sfree(g->seen);
+  sfree(g);
 }
 
-static float doorprobability(const game_params *params, SmPowerRoom** states, SmPowerRoom* rstate, int dir, int breakup)
+static float doorprobability(const game_params *params, SmPowerGraph* g, int r, int dir, int breakup)
 {
   float probdoor;
-  if ((params->style == Tandem ? rstate->coord[2] : rstate->coord[0]) == -1) { /* First state in all styles */
+  int* coord = roomcoord(g, r);
+  if ((params->style == Tandem ? coord[2] : coord[0]) == -1) { /* First state in all styles */
     if (dir == 0)
       return 1.0;
     else
       return 0.0;
-  } else if (rstate->coord[0] == params->size) { /* Goal state in all styles */
+  } else if (coord[0] == params->size) { /* Goal state in all styles */
     if (dir == 1)
       return 1.0;
     else
@@ -1466,21 +1541,21 @@ static float doorprobability(const game_params *params, SmPowerRoom** states, Sm
     probdoor = 0.4;
     if (dir >= 4*(params->keys+1)) {
       if (params->difficult)
-        return (rstate->domain == 2 ? 0.002 : 0.000001)/params->keys;
-/*        return (breakup ? (rstate->domain == 2 ? 0.2 : 0.001)/params->keys : 0.0);*/
-/*        return (rstate->domain == 2 ? 0.2 : 0.05)/params->keys; */
+        return (g->domain[r] == 2 ? 0.002 : 0.000001)/params->keys;
+/*        return (breakup ? (g->domain[r] == 2 ? 0.2 : 0.001)/params->keys : 0.0);*/
+/*        return (g->domain[r] == 2 ? 0.2 : 0.05)/params->keys; */
       else
         return 0.04 / params->keys;
     } else if (dir >= 4) {
       if (params->difficult)
-        return (rstate->domain == 2 ? 0.000001 : 0.08)/params->keys;
-/*        return (rstate->domain == 2 ? (breakup ? 0.001 : 0.0) : 0.08)/params->keys;*/
-/*        return (rstate->domain == 2 ? 0.05 : 0.2)/params->keys; */
+        return (g->domain[r] == 2 ? 0.000001 : 0.08)/params->keys;
+/*        return (g->domain[r] == 2 ? (breakup ? 0.001 : 0.0) : 0.08)/params->keys;*/
+/*        return (g->domain[r] == 2 ? 0.05 : 0.2)/params->keys; */
       else
         return 0.1 / params->keys;
     } else {
       if (params->difficult)
-        return (rstate->domain == 2 ? 0.16 : 0.01);
+        return (g->domain[r] == 2 ? 0.16 : 0.01);
       else
         return 0.08;
     }
@@ -1496,12 +1571,12 @@ static float doorprobability(const game_params *params, SmPowerRoom** states, Sm
     probdoor = 0.3;
     if (dir >= 4*(params->keys+params->levers+1)) {
       if (params->difficult && dir >= 4*(params->keys+params->levers+1) + 2 + params->levers)
-        return (rstate->domain == 2 ? 0.15 : 0.03)/params->keys;
+        return (g->domain[r] == 2 ? 0.15 : 0.03)/params->keys;
       else
         return 0.2 * probdoor / (params->keys+params->levers+2);
     } else if (dir >= 4) {
       if (params->difficult && dir >= 4*(params->levers+1))
-        return (rstate->domain == 2 ? 0.03 : 0.15)/params->keys;
+        return (g->domain[r] == 2 ? 0.03 : 0.15)/params->keys;
       else
         return 0.5 * probdoor / (params->keys+params->levers+2);
     } else
@@ -1512,50 +1587,51 @@ static float doorprobability(const game_params *params, SmPowerRoom** states, Sm
   }
 }
 
-static void initializestates(const game_params *params, int num, SmPowerRoom**states)
+static void initializestates(const game_params *params, SmPowerGraph* g)
 {
   int ind, x1, y1, x2, y2, z1, h;
+  int num = g->num;
   int size = params->size;
   if (params->style == Basic) {
     for (ind=0, y1=0; y1<size; y1++)
       for (x1=(y1==0 ? -1 : 0); x1<(y1==size-1 ? size+1 : size); x1++, ind++)
-        states[ind]->coord[0] = x1, states[ind]->coord[1] = y1; 
+        roomcoord(g, ind)[0] = x1, roomcoord(g, ind)[1] = y1; 
   }
   else if (params->style == Tandem) {
-    states[0]->coord[0] = -1, states[0]->coord[1] = 0, states[0]->coord[2] = -1, states[0]->coord[3] = 0; 
+    roomcoord(g, 0)[0] = -1, roomcoord(g, 0)[1] = 0, roomcoord(g, 0)[2] = -1, roomcoord(g, 0)[3] = 0; 
     for (ind=1, y2=0; y2<size; y2++)
       for (x2=(y2==0 ? -1 : 0); x2<(y2==size-1 ? size+1 : size); x2++)
         for (y1=0; y1<=y2; y1++)
           for (x1=(y1==0 ? -1 : 0); x1<(y1==y2 ? x2 : size); x1++, ind++)
-            states[ind]->coord[0] = x1, states[ind]->coord[1] = y1, states[ind]->coord[2] = x2, states[ind]->coord[3] = y2; 
-    states[num-1]->coord[0] = size, states[num-1]->coord[1] = size-1, states[num-1]->coord[2] = size, states[num-1]->coord[3] = size-1; 
+            roomcoord(g, ind)[0] = x1, roomcoord(g, ind)[1] = y1, roomcoord(g, ind)[2] = x2, roomcoord(g, ind)[3] = y2; 
+    roomcoord(g, num-1)[0] = size, roomcoord(g, num-1)[1] = size-1, roomcoord(g, num-1)[2] = size, roomcoord(g, num-1)[3] = size-1; 
   }
   else if (params->style == ThreeD) {
     for (ind=0, z1=0; z1<size; z1++)
       for (y1=0; y1<size; y1++)
         for (x1=((y1==0 && z1==0) ? -1 : 0); x1<((y1==size-1 && z1==size-1) ? size+1 : size); x1++, ind++)
-          states[ind]->coord[0] = x1, states[ind]->coord[1] = y1, states[ind]->coord[2] = z1; 
+          roomcoord(g, ind)[0] = x1, roomcoord(g, ind)[1] = y1, roomcoord(g, ind)[2] = z1; 
   }
   else if (params->style == Floors) {
     int fl = params->floors;
     for (ind=0, z1=0; z1<fl; z1++)
       for (y1=0; y1<size; y1++)
         for (x1=((y1==0 && z1==0) ? -1 : 0); x1<((y1==size-1 && z1==fl-1) ? size+1 : size); x1++, ind++)
-          states[ind]->coord[0] = x1, states[ind]->coord[1] = y1, states[ind]->coord[2] = z1; 
+          roomcoord(g, ind)[0] = x1, roomcoord(g, ind)[1] = y1, roomcoord(g, ind)[2] = z1; 
   }
   else if (params->style == Keys) {
     int ls = 1 << params->keys;
     for (ind=0, y1=0; y1<size; y1++)
       for (x1=((y1==0) ? -1 : 0); x1<(y1==size-1 ? size+1 : size); x1++)
         for (h=0; h<ls; h++, ind++)
-          states[ind]->coord[0] = x1, states[ind]->coord[1] = y1, states[ind]->coord[2] = h; 
+          roomcoord(g, ind)[0] = x1, roomcoord(g, ind)[1] = y1, roomcoord(g, ind)[2] = h; 
   }
   else if (params->style == Levers) {
     int ls = 1 << params->levers;
     for (ind=0, y1=0; y1<size; y1++)
       for (x1=((y1==0) ? -1 : 0); x1<(y1==size-1 ? size+1 : size); x1++)
         for (h=0; h<ls; h++, ind++)
-          states[ind]->coord[0] = x1, states[ind]->coord[1] = y1, states[ind]->coord[2] = h; 
+          roomcoord(g, ind)[0] = x1, roomcoord(g, ind)[1] = y1, roomcoord(g, ind)[2] = h; 
   }
   else if (params->style == Combo) {
     int ls = 1 << (params->keys + params->levers);
@@ -1564,7 +1640,7 @@ static void initializestates(const game_params *params, int num, SmPowerRoom**st
       for (y1=0; y1<size; y1++)
         for (x1=((y1==0 && z1==0) ? -1 : 0); x1<(y1==size-1 && z1==fl-1 ? size+1 : size); x1++)
           for (h=0; h<ls; h++, ind++)
-            states[ind]->coord[0] = x1, states[ind]->coord[1] = y1, states[ind]->coord[2] = z1, states[ind]->coord[3] = h; 
+            roomcoord(g, ind)[0] = x1, roomcoord(g, ind)[1] = y1, roomcoord(g, ind)[2] = z1, roomcoord(g, ind)[3] = h; 
   }
 }
 
@@ -1578,68 +1654,57 @@ Connected when it is reached by one good domain and put in queue;
 Island when connected to nearby rooms but not yet to a good domain;
 and Complete when all doors are set and the room has a final domain.
 */
-static SmPowerRoom** makepowerstates(const game_params *params, random_state *rs)
+static SmPowerGraph* makepowerstates(const game_params *params, random_state *rs)
 {
   int ind, dom, rdir, count, dom1, dom2;
   int bnind, bndir;
   int tmpscore, *maxscore, *maxind, *maxdir;
-  int i, j, nn;
+  int i, j, nn, r;
   float prob;
   int size = params->size;
-  int ncoord = numcoord(params);
-  int ndoors = numdoors(params);
-  int num = numindex(params);
+  SmPowerGraph* g = new_powerstates(params);
+  int ndoors = g->ndoors;
+  int num = g->num;
   int numpool = 0;
   int* pooldir = snewn(num*(ndoors-2), int);
   int* pooldom = snewn(num*(ndoors-2), int);
   float* poolprob = snewn(num*(ndoors-2), float);
   float* domprob = snewn(MAXDOMAIN+1, float);
-  SmPowerRoom** pool = snewn(num*(ndoors-2), SmPowerRoom*);
-  SmPowerRoom** states = snewn(num, SmPowerRoom*);
-  SmPowerRoom* rstate;
-  for (ind=0; ind<num; ind++) {
-    states[ind] = snew(SmPowerRoom);
-    states[ind]->status = Unallocated;
-    states[ind]->domain = -1;
-    states[ind]->coord = snewn(ncoord, int);
-    states[ind]->trans = snewn(ndoors, SmPowerRoom*);
-    states[ind]->door = snewn(ndoors, SmPowerDoor);
-    states[ind]->recdir = snewn(ndoors, int);
-  }
+  int* pool = snewn(num*(ndoors-2), int);
 
-  initializestates(params, num, states);
+  initializestates(params, g);
   for (i=0; i<num; i++)
     for (j=0; j<ndoors; j++) {
-      ind = getnearbyindex(params, states[i]->coord, j, &rdir);
+      ind = getnearbyindex(params, roomcoord(g, i), j, &rdir);
       if (ind > -1) {
-        states[i]->trans[j] = states[ind];
-        states[i]->door[j] = Unset;
-        states[i]->recdir[j] = rdir;
+        g->trans[i*ndoors + j] = ind;
+        g->door[i*ndoors + j] = Unset;
+        g->recdir[i*ndoors + j] = rdir;
       } else {
-        states[i]->trans[j] = 0;
-        states[i]->door[j] = Impossible;
-        states[i]->recdir[j] = -1;
+        g->trans[i*ndoors + j] = -1;
+        g->door[i*ndoors + j] = Impossible;
+        g->recdir[i*ndoors + j] = -1;
       }
     }
   /* Put first and last room in pool */
-  states[0]->domain = 1;
-  states[0]->status = Connected;
-  pool[numpool++] = states[0];
-  states[num-1]->domain = 2;
-  states[num-1]->status = Connected;
-  pool[numpool++] = states[num-1];
+  g->domain[0] = 1;
+  g->status[0] = Connected;
+  pool[numpool++] = 0;
+  g->domain[num-1] = 2;
+  g->status[num-1] = Connected;
+  pool[numpool++] = num-1;
 
   if (params->style == Keys || params->style == Levers || params->style == Combo) {
     nn = (params->style == Keys ? 1<<params->keys : params->style == Levers ? 1<<params->levers : 1<<(params->keys + params->levers));
     for (i=0; i<nn-1; i++) {
-      pool[numpool] = states[num-nn+i];
+      pool[numpool] = num-nn+i;
       if (params->difficult &&
           (params->style == Keys ||
            (params->style == Combo && i <= (1<<(params->keys + params->levers)) - (1<<(params->levers)))))
-        pool[numpool]->domain = 0;
+        g->domain[pool[numpool]] = 0;
       else
-        pool[numpool]->domain = 2;
-      pool[numpool]->status = Connected;
+        g->domain[pool[numpool]] = 2;
+      g->status[pool[numpool]] = Connected;
       numpool++;
     }
   }
@@ -1650,27 +1715,28 @@ static SmPowerRoom** makepowerstates(const game_params *params, random_state *rs
     while (1) {
       ind = random_upto(rs, num-2) + 1;
       j = random_upto(rs, ndoors);
-      if (states[ind]->status == Unallocated && states[ind]->door[j] == Unset)
+      if (g->status[ind] == Unallocated && g->door[ind*ndoors + j] == Unset)
         break;
     }
-    nm = getmirrordoors(params, states[ind]->coord, j, &ms, &md);
+    nm = getmirrordoors(params, roomcoord(g, ind), j, &ms, &md);
     for (i=0; i<nm; i++) {
-      states[ms[i]]->status = Connected;
-      states[ms[i]]->trans[md[i]]->status = Connected;
+      r = g->trans[ms[i]*ndoors + md[i]];
+      g->status[ms[i]] = Connected;
+      g->status[r] = Connected;
 /*      if ((params->style == Keys || params->style == Levers) &&
-          (states[ms[i]]->coord[2]&3) != 3) {
-        states[ms[i]]->domain = 0;
-        states[ms[i]]->trans[md[i]]->domain = 0;
+          (roomcoord(g, ms[i])[2]&3) != 3) {
+        g->domain[ms[i]] = 0;
+        g->domain[r] = 0;
       } else {
 */
-      states[ms[i]]->domain = 3;
-      states[ms[i]]->trans[md[i]]->domain = 4;
-      pool[numpool++] = states[ms[i]];
-      pool[numpool++] = states[ms[i]]->trans[md[i]];
+      g->domain[ms[i]] = 3;
+      g->domain[r] = 4;
+      pool[numpool++] = ms[i];
+      pool[numpool++] = r;
     }
     bnind = ind;
     bndir = j;
-    opendoor(params, states, states[ind], j, ndoors, pool, &numpool);
+    opendoor(params, g, ind, j, pool, &numpool);
   } else {
     bnind = -1;
     bndir = -1;
@@ -1681,16 +1747,16 @@ static SmPowerRoom** makepowerstates(const game_params *params, random_state *rs
     while (numpool) { /* As long as there are rooms in the pool */
       /* Draw a room, determine doors, put new rooms in pool */
       ind = random_upto(rs, numpool);
-      rstate = pool[ind];
+      r = pool[ind];
       pool[ind] = pool[--numpool];
       for (j=0; j<ndoors; j++)
-        if (rstate->door[j] == Unset) {
-          if (binary(doorprobability(params, states, rstate, j, 0), rs) && canopendoor(params, states, rstate, j))
-            opendoor(params, states, rstate, j, ndoors, pool, &numpool);
+        if (g->door[r*ndoors + j] == Unset) {
+          if (binary(doorprobability(params, g, r, j, 0), rs) && canopendoor(params, g, r, j))
+            opendoor(params, g, r, j, pool, &numpool);
           else
-            closedoor(params, states, rstate, j);
+            closedoor(params, g, r, j);
         }
-      rstate->status = Complete;
+      g->status[r] = Complete;
       count++;
     }
     /* Break through some walls */
@@ -1701,11 +1767,11 @@ static SmPowerRoom** makepowerstates(const game_params *params, random_state *rs
     for (i=0; i<num; i++)
       for (j=0; j<ndoors; j++)
         if (firstmirrorstate(params, i, j) == i &&
-            canbreakupdoor(params, states, states[i], j, &dom)) {
-          pool[numpool] = states[i];
+            canbreakupdoor(params, g, i, j, &dom)) {
+          pool[numpool] = i;
           pooldir[numpool] = j;
           pooldom[numpool] = dom;
-          domprob[dom] += poolprob[numpool] = doorprobability(params, states, states[i], j, 1);
+          domprob[dom] += poolprob[numpool] = doorprobability(params, g, i, j, 1);
           numpool++;
         }
 
@@ -1738,10 +1804,10 @@ static SmPowerRoom** makepowerstates(const game_params *params, random_state *rs
       prob -= poolprob[j];
     */
 
-    rstate = pool[j];
+    r = pool[j];
     j = pooldir[j];
     numpool = 0;
-    opendoor(params, states, rstate, j, ndoors, pool, &numpool);
+    opendoor(params, g, r, j, pool, &numpool);
   }
 
   /* Open up the bottleneck */
@@ -1751,35 +1817,34 @@ static SmPowerRoom** makepowerstates(const game_params *params, random_state *rs
   maxdir = snewn(nn, int);
   for (i=0; i<nn; i++)
     maxscore[i] = 0, maxind[i] = -1, maxdir[i] = -1;
-  for (i=0; i<num; i++)
-    states[i]->dist = -1;
+  cleardistance(g);
   numpool = (params->style == Keys ? 1<<params->keys : params->style == Levers ? 1<<params->levers : params->style == Combo ? 1<<(params->keys + params->levers) : 1);
   for (i=0; i<numpool; i++) {
-    pool[i] = states[num-numpool+i];
+    pool[i] = num-numpool+i;
   }
-  calcdistance(pool, numpool, ndoors);
-  if (states[0]->dist != -1) {
+  calcdistance(g, pool, numpool, ndoors);
+  if (g->dist[0] != -1) {
     /* There is a leak - abort and try again */
     printf("Found a leak, restarting.\n");
     goto failure;
   }
-  pool[0] = states[0];
-  calcdistance(pool, 1, ndoors);
+  pool[0] = 0;
+  calcdistance(g, pool, 1, ndoors);
 
   if (bnind != -1) {
-    if (states[bnind]->dist != -1) {
+    if (g->dist[bnind] != -1) {
       /* There is a leak - abort and try again */
       printf("Found a leak (BN), restarting.\n");
       goto failure;
     }
-    pool[0] = states[bnind];
-    pool[1] = states[bnind]->trans[bndir];
-    calcdistance(pool, 2, ndoors);
+    pool[0] = bnind;
+    pool[1] = g->trans[bnind*ndoors + bndir];
+    calcdistance(g, pool, 2, ndoors);
   }
   for (i=0; i<num; i++)
     for (j=0; j<ndoors; j++)
       if (firstmirrorstate(params, i, j) == i &&
-          canbreakupdoor_conn(params, states, states[i], j, &tmpscore, &dom1, &dom2))
+          canbreakupdoor_conn(params, g, i, j, &tmpscore, &dom1, &dom2))
         if (tmpscore > maxscore[(dom2-1)*(dom2-2)/2 + (dom1-1)]) {
           maxscore[(dom2-1)*(dom2-2)/2 + (dom1-1)] = tmpscore;
           maxind[(dom2-1)*(dom2-2)/2 + (dom1-1)] = i;
@@ -1794,11 +1859,11 @@ static SmPowerRoom** makepowerstates(const game_params *params, random_state *rs
     if (s1342 || s1432) {
       numpool = 0;
       if (s1342 > s1432) {
-        opendoor(params, states,  states[maxind[1]], maxdir[1], ndoors, pool, &numpool);
-        opendoor(params, states,  states[maxind[4]], maxdir[4], ndoors, pool, &numpool);
+        opendoor(params, g, maxind[1], maxdir[1], pool, &numpool);
+        opendoor(params, g, maxind[4], maxdir[4], pool, &numpool);
       } else {
-        opendoor(params, states,  states[maxind[3]], maxdir[3], ndoors, pool, &numpool);
-        opendoor(params, states,  states[maxind[2]], maxdir[2], ndoors, pool, &numpool);
+        opendoor(params, g, maxind[3], maxdir[3], pool, &numpool);
+        opendoor(params, g, maxind[2], maxdir[2], pool, &numpool);
       }
       /* printf("Bottleneck opened\n"); */
     } else {
@@ -1809,17 +1874,18 @@ static SmPowerRoom** makepowerstates(const game_params *params, random_state *rs
   } else {
     if (maxscore[0]) {
       numpool = 0;
-      opendoor(params, states,  states[maxind[0]], maxdir[0], ndoors, pool, &numpool);
+      opendoor(params, g, maxind[0], maxdir[0], pool, &numpool);
       /*
-      if (states[maxind[0]]->domain != states[maxind[0]]->trans[maxdir[0]]->domain)
-        printf("Bottleneck dist: %d + %d  { ", states[maxind[0]]->dist, states[maxind[0]]->trans[maxdir[0]]->dist);
+      r = g->trans[maxind[0]*ndoors + maxdir[0]];
+      if (g->domain[maxind[0]] != g->domain[r])
+        printf("Bottleneck dist: %d + %d  { ", g->dist[maxind[0]], g->dist[r]);
       else
         printf("Bottleneck dist: approx %d  { ", 2*(int)sqrt(maxscore[0]) -2);
-      for (i=0; i<ncoord; i++)
-        printf("%d ", states[maxind[0]]->coord[i]);
+      for (i=0; i<g->ncoord; i++)
+        printf("%d ", roomcoord(g, maxind[0])[i]);
       printf("} <-> { ");
-      for (i=0; i<ncoord; i++)
-        printf("%d ", states[maxind[0]]->trans[maxdir[0]]->coord[i]);
+      for (i=0; i<g->ncoord; i++)
+        printf("%d ", roomcoord(g, r)[i]);
       printf("}\n");
       */
     } else {
@@ -1831,11 +1897,10 @@ static SmPowerRoom** makepowerstates(const game_params *params, random_state *rs
 
   /* Check for trivial solutions */
   if (params->style == Tandem) {
-    for (i=0; i<num; i++)
-      states[i]->dist = -1;
-    pool[0] = states[num - size*size - 2];
-    calcdistance(pool, 1, 4);
-    if (states[num-1]->dist != -1) {
+    cleardistance(g);
+    pool[0] = num - size*size - 2;
+    calcdistance(g, pool, 1, 4);
+    if (g->dist[num-1] != -1) {
       printf("Trivial solution, restarting.\n");
       goto failure;
     }
@@ -1846,21 +1911,19 @@ static SmPowerRoom** makepowerstates(const game_params *params, random_state *rs
     int trivialdoors = (params->style == Keys ? 4 * (1 + params->keys) :
                         params->style == Levers ? 4 * (1 + params->levers) :
                         4 * (params->keys+params->levers+1));
-    for (i=0; i<num; i++)
-      states[i]->dist = -1;
-    pool[0] = states[0];
-    calcdistance(pool, 1, trivialdoors);
-    if (states[trivialend]->dist != -1) {
+    cleardistance(g);
+    pool[0] = 0;
+    calcdistance(g, pool, 1, trivialdoors);
+    if (g->dist[trivialend] != -1) {
       printf("Trivial solution, restarting.\n");
       goto failure;
     }
   }
   /* And nonconnected mazes */
-  for (i=0; i<num; i++)
-    states[i]->dist = -1;
-  pool[0] = states[0];
-  calcdistance(pool, 1, ndoors);
-  if (states[num-1]->dist == -1) {
+  cleardistance(g);
+  pool[0] = 0;
+  calcdistance(g, pool, 1, ndoors);
+  if (g->dist[num-1] == -1) {
     printf("Not connected, restarting.\n");
     goto failure;
   }
@@ -1873,11 +1936,11 @@ static SmPowerRoom** makepowerstates(const game_params *params, random_state *rs
   sfree(maxscore);
   sfree(maxind);
   sfree(maxdir);
-  return states;
+  return g;
 
  failure:
 
-  free_powerstates(states, params);
+  free_powerstates(g);
   sfree(pool);
   sfree(pooldir);
   sfree(pooldom);
@@ -1922,10 +1985,10 @@ static void initializemaze(SuperMaze* maze, const game_params *params)
   maze->roomvector = (nrooms ? snewn(nrooms, int) : 0);
 }
 
-static SuperMaze* makesupermaze(SmPowerRoom** states, const game_params *params, random_state *rs)
+static SuperMaze* makesupermaze(SmPowerGraph* g, const game_params *params, random_state *rs)
 {
   int ind, sw, ord;
-  SmPowerRoom* rstate;
+  unsigned char* rdoor;
   SuperMaze* maze = snew(SuperMaze);
   int size = params->size;
   int coord[MAXCOORD];
@@ -1937,11 +2000,11 @@ static SuperMaze* makesupermaze(SmPowerRoom** states, const game_params *params,
       for (coord[0]=0; coord[0]<size; coord[0]++) {
         ind = getindex(coord, params);
         if (ind > -1) {
-          rstate = states[ind];
+          rdoor = g->door + ind*g->ndoors;
           setdoor(maze->doorvector, size, coord[0], coord[1], 0, 0, 
-                  ((rstate->door[0] == Open || (rstate->door[0] == Unset && binary(probdoor, rs))) ? 1 : 0));
+                  ((rdoor[0] == Open || (rdoor[0] == Unset && binary(probdoor, rs))) ? 1 : 0));
           setdoor(maze->doorvector, size, coord[0], coord[1], 0, 2,
-                  ((rstate->door[2] == Open || (rstate->door[2] == Unset && binary(probdoor, rs))) ? 1 : 0));
+                  ((rdoor[2] == Open || (rdoor[2] == Unset && binary(probdoor, rs))) ? 1 : 0));
         }
       }
   } else if (params->style == Tandem) {
@@ -1950,11 +2013,11 @@ static SuperMaze* makesupermaze(SmPowerRoom** states, const game_params *params,
       for (coord[2]=0; coord[2]<size; coord[2]++) {
         ind = getindex(coord, params);
         if (ind > -1) {
-          rstate = states[ind];
+          rdoor = g->door + ind*g->ndoors;
           setdoor(maze->doorvector, size, coord[2], coord[3], 0, 0, 
-                  ((rstate->door[4] == Open || (rstate->door[4] == Unset && binary(probdoor, rs))) ? 1 : 0));
+                  ((rdoor[4] == Open || (rdoor[4] == Unset && binary(probdoor, rs))) ? 1 : 0));
           setdoor(maze->doorvector, size, coord[2], coord[3], 0, 2,
-                  ((rstate->door[6] == Open || (rstate->door[6] == Unset && binary(probdoor, rs))) ? 1 : 0));
+                  ((rdoor[6] == Open || (rdoor[6] == Unset && binary(probdoor, rs))) ? 1 : 0));
         }
       }
     for (sw=0, coord[1]=0; coord[1]<size; coord[1]++)
@@ -1968,15 +2031,15 @@ static SuperMaze* makesupermaze(SmPowerRoom** states, const game_params *params,
             } else {
               ind = getindex(coord, params);
               if (ind > -1) {
-                rstate = states[ind];
+                rdoor = g->door + ind*g->ndoors;
                 setdoor(maze->doorswitches[sw], size, coord[2], coord[3], 0, 0, 
-                        (rstate->door[ord?4:0] == Impossible ? 0 :
-                         rstate->door[ord?4:0] == Unset ? (binary(probdoor, rs) ? 1 : 0) :
-                         (rstate->door[ord?4:0] == Open ? 1 : 0) ^ getdoor(maze->doorvector, size, coord[2], coord[3], 0, 0)));
+                        (rdoor[ord?4:0] == Impossible ? 0 :
+                         rdoor[ord?4:0] == Unset ? (binary(probdoor, rs) ? 1 : 0) :
+                         (rdoor[ord?4:0] == Open ? 1 : 0) ^ getdoor(maze->doorvector, size, coord[2], coord[3], 0, 0)));
                 setdoor(maze->doorswitches[sw], size, coord[2], coord[3], 0, 2, 
-                        (rstate->door[ord?6:2] == Impossible ? 0 :
-                         rstate->door[ord?6:2] == Unset ? (binary(probdoor, rs) ? 1 : 0) :
-                         (rstate->door[ord?6:2] == Open ? 1 : 0) ^ getdoor(maze->doorvector, size, coord[2], coord[3], 0, 2)));
+                        (rdoor[ord?6:2] == Impossible ? 0 :
+                         rdoor[ord?6:2] == Unset ? (binary(probdoor, rs) ? 1 : 0) :
+                         (rdoor[ord?6:2] == Open ? 1 : 0) ^ getdoor(maze->doorvector, size, coord[2], coord[3], 0, 2)));
               }
             }
           }
@@ -1988,13 +2051,13 @@ static SuperMaze* makesupermaze(SmPowerRoom** states, const game_params *params,
         for (coord[0]=0; coord[0]<size; coord[0]++, k++) {
           ind = getindex(coord, params);
           if (ind > -1) {
-            rstate = states[ind];
+            rdoor = g->door + ind*g->ndoors;
             setdoor(maze->doorvector, size, coord[0], coord[1], coord[2], 0, 
-                    ((rstate->door[0] == Open || (rstate->door[0] == Unset && binary(probdoor, rs))) ? 1 : 0));
+                    ((rdoor[0] == Open || (rdoor[0] == Unset && binary(probdoor, rs))) ? 1 : 0));
             setdoor(maze->doorvector, size, coord[0], coord[1], coord[2], 2,
-                    ((rstate->door[2] == Open || (rstate->door[2] == Unset && binary(probdoor, rs))) ? 1 : 0));
-            up = ((rstate->door[4] == Open || (rstate->door[4] == Unset && binary(probdoor, rs))) ? 1 : 0);
-            down = ((rstate->door[5] == Open || (rstate->door[5] == Unset && states[ind-size*size]->door[4] == Open)) ? 1 : 0);
+                    ((rdoor[2] == Open || (rdoor[2] == Unset && binary(probdoor, rs))) ? 1 : 0));
+            up = ((rdoor[4] == Open || (rdoor[4] == Unset && binary(probdoor, rs))) ? 1 : 0);
+            down = ((rdoor[5] == Open || (rdoor[5] == Unset && g->door[(ind-size*size)*g->ndoors + 4] == Open)) ? 1 : 0);
             maze->roomvector[k] = up + 2*down;
         }
       }
@@ -2005,20 +2068,20 @@ static SuperMaze* makesupermaze(SmPowerRoom** states, const game_params *params,
         for (coord[0]=0; coord[0]<size; coord[0]++, k++) {
           ind = getindex(coord, params);
           if (ind > -1) {
-            rstate = states[ind];
+            rdoor = g->door + ind*g->ndoors;
             setdoor(maze->doorvector, size, coord[0], coord[1], coord[2], 0, 
-                    ((rstate->door[0] == Open || (rstate->door[0] == Unset && binary(probdoor, rs))) ? 1 : 0));
+                    ((rdoor[0] == Open || (rdoor[0] == Unset && binary(probdoor, rs))) ? 1 : 0));
             setdoor(maze->doorvector, size, coord[0], coord[1], coord[2], 2,
-                    ((rstate->door[2] == Open || (rstate->door[2] == Unset && binary(probdoor, rs))) ? 1 : 0));
+                    ((rdoor[2] == Open || (rdoor[2] == Unset && binary(probdoor, rs))) ? 1 : 0));
             fl = -1;
             for (i=0; i<params->floors-1; i++)
-              if (rstate->door[4+i] == Open)
+              if (rdoor[4+i] == Open)
                 fl = (i<coord[2] ? i : i+1);
             maze->roomvector[k] = fl;
         }
       }
   } else if (params->style == Keys) {
-    SmPowerRoom* rstate2;
+    unsigned char* rdoor2;
     int ind2;
     int o1, o2, i, k, key, done_e, done_s;
     for (coord[1]=0, k=0; coord[1]<size; coord[1]++)
@@ -2028,20 +2091,20 @@ static SuperMaze* makesupermaze(SmPowerRoom** states, const game_params *params,
         coord[2] = (1 << params->keys)-1;
         ind2 = getindex(coord, params);
         if (ind > -1) {
-          rstate = states[ind];
-          rstate2 = states[ind2];
+          rdoor = g->door + ind*g->ndoors;
+          rdoor2 = g->door + ind2*g->ndoors;
           done_e = done_s = 0;
           for (i=0; i<params->keys; i++) {
-            o1 = (rstate->door[4 + 4*i] == Open);
-            o2 = (rstate2->door[4 + 4*i] == Open);
+            o1 = (rdoor[4 + 4*i] == Open);
+            o2 = (rdoor2[4 + 4*i] == Open);
             if (o1 != o2) {
               setdoor(maze->doorswitches[i], size, coord[0], coord[1], 0, 0, 1);
               setdoor(maze->doorvector, size, coord[0], coord[1], 0, 0, 0);
               done_e = 1;
             } else
               setdoor(maze->doorswitches[i], size, coord[0], coord[1], 0, 0, 0);
-            o1 = (rstate->door[6 + 4*i] == Open);
-            o2 = (rstate2->door[6 + 4*i] == Open);
+            o1 = (rdoor[6 + 4*i] == Open);
+            o2 = (rdoor2[6 + 4*i] == Open);
             if (o1 != o2) {
               setdoor(maze->doorswitches[i], size, coord[0], coord[1], 0, 2, 1);
               setdoor(maze->doorvector, size, coord[0], coord[1], 0, 2, 0);
@@ -2051,19 +2114,19 @@ static SuperMaze* makesupermaze(SmPowerRoom** states, const game_params *params,
           }
           if (!done_e)
             setdoor(maze->doorvector, size, coord[0], coord[1], 0, 0, 
-                    ((rstate->door[0] == Open || (rstate->door[0] == Unset && binary(probdoor, rs))) ? 1 : 0));
+                    ((rdoor[0] == Open || (rdoor[0] == Unset && binary(probdoor, rs))) ? 1 : 0));
           if (!done_s)
             setdoor(maze->doorvector, size, coord[0], coord[1], 0, 2,
-                    ((rstate->door[2] == Open || (rstate->door[2] == Unset && binary(probdoor, rs))) ? 1 : 0));
+                    ((rdoor[2] == Open || (rdoor[2] == Unset && binary(probdoor, rs))) ? 1 : 0));
           key = -1;
           for (i=0; i<params->keys; i++)
-            if (rstate->door[4+4*params->keys+i] == Open)
+            if (rdoor[4+4*params->keys+i] == Open)
               key = i;
           maze->roomvector[k] = key;
         }
       }
   } else if (params->style == Levers) {
-    SmPowerRoom* rstate2;
+    unsigned char* rdoor2;
     int ind2;
     int o1, o2, i, k, lev, done_e, done_s;
     for (coord[1]=0, k=0; coord[1]<size; coord[1]++)
@@ -2073,20 +2136,20 @@ static SuperMaze* makesupermaze(SmPowerRoom** states, const game_params *params,
         coord[2] = (1 << params->levers)-1;
         ind2 = getindex(coord, params);
         if (ind > -1) {
-          rstate = states[ind];
-          rstate2 = states[ind2];
+          rdoor = g->door + ind*g->ndoors;
+          rdoor2 = g->door + ind2*g->ndoors;
           done_e = done_s = 0;
           for (i=0; i<params->levers; i++) {
-            o1 = (rstate->door[4 + 4*i] == Open);
-            o2 = (rstate2->door[4 + 4*i] == Open);
+            o1 = (rdoor[4 + 4*i] == Open);
+            o2 = (rdoor2[4 + 4*i] == Open);
             if (o1 != o2) {
               setdoor(maze->doorswitches[i], size, coord[0], coord[1], 0, 0, 1);
               setdoor(maze->doorvector, size, coord[0], coord[1], 0, 0, (o1 ? 1 : 0));
               done_e = 1;
             } else
               setdoor(maze->doorswitches[i], size, coord[0], coord[1], 0, 0, 0);
-            o1 = (rstate->door[6 + 4*i] == Open);
-            o2 = (rstate2->door[6 + 4*i] == Open);
+            o1 = (rdoor[6 + 4*i] == Open);
+            o2 = (rdoor2[6 + 4*i] == Open);
             if (o1 != o2) {
               setdoor(maze->doorswitches[i], size, coord[0], coord[1], 0, 2, 1);
               setdoor(maze->doorvector, size, coord[0], coord[1], 0, 2, (o1 ? 1 : 0));
@@ -2096,19 +2159,19 @@ static SuperMaze* makesupermaze(SmPowerRoom** states, const game_params *params,
           }
           if (!done_e)
             setdoor(maze->doorvector, size, coord[0], coord[1], 0, 0, 
-                    ((rstate->door[0] == Open || (rstate->door[0] == Unset && binary(probdoor, rs))) ? 1 : 0));
+                    ((rdoor[0] == Open || (rdoor[0] == Unset && binary(probdoor, rs))) ? 1 : 0));
           if (!done_s)
             setdoor(maze->doorvector, size, coord[0], coord[1], 0, 2,
-                    ((rstate->door[2] == Open || (rstate->door[2] == Unset && binary(probdoor, rs))) ? 1 : 0));
+                    ((rdoor[2] == Open || (rdoor[2] == Unset && binary(probdoor, rs))) ? 1 : 0));
           lev = -1;
           for (i=0; i<params->levers; i++)
-            if (rstate->door[4+4*params->levers+i] == Open)
+            if (rdoor[4+4*params->levers+i] == Open)
               lev = i;
           maze->roomvector[k] = lev;
         }
       }
   } else if (params->style == Combo) {
-    SmPowerRoom* rstate2;
+    unsigned char* rdoor2;
     int ind2;
     int o1, o2, i, k, up, down, rp, done_e, done_s;
     for (coord[2]=0, k=0; coord[2]<params->floors; coord[2]++)
@@ -2119,20 +2182,20 @@ static SuperMaze* makesupermaze(SmPowerRoom** states, const game_params *params,
           coord[3] = (1 << (params->keys + params->levers))-1;
           ind2 = getindex(coord, params);
           if (ind > -1) {
-            rstate = states[ind];
-            rstate2 = states[ind2];
+            rdoor = g->door + ind*g->ndoors;
+            rdoor2 = g->door + ind2*g->ndoors;
             done_e = done_s = 0;
             for (i=0; i<(params->keys+params->levers); i++) {
-              o1 = (rstate->door[4 + 4*i] == Open);
-              o2 = (rstate2->door[4 + 4*i] == Open);
+              o1 = (rdoor[4 + 4*i] == Open);
+              o2 = (rdoor2[4 + 4*i] == Open);
               if (o1 != o2) {
                 setdoor(maze->doorswitches[i], size, coord[0], coord[1], coord[2], 0, 1);
                 setdoor(maze->doorvector, size, coord[0], coord[1], coord[2], 0, (o1 && i<params->levers ? 1 : 0));
                 done_e = 1;
               } else
                 setdoor(maze->doorswitches[i], size, coord[0], coord[1], coord[2], 0, 0);
-              o1 = (rstate->door[6 + 4*i] == Open);
-              o2 = (rstate2->door[6 + 4*i] == Open);
+              o1 = (rdoor[6 + 4*i] == Open);
+              o2 = (rdoor2[6 + 4*i] == Open);
               if (o1 != o2) {
                 setdoor(maze->doorswitches[i], size, coord[0], coord[1], coord[2], 2, 1);
                 setdoor(maze->doorvector, size, coord[0], coord[1], coord[2], 2, (o1 && i<params->levers ? 1 : 0));
@@ -2142,18 +2205,18 @@ static SuperMaze* makesupermaze(SmPowerRoom** states, const game_params *params,
             }
             if (!done_e)
               setdoor(maze->doorvector, size, coord[0], coord[1], coord[2], 0, 
-                      ((rstate->door[0] == Open || (rstate->door[0] == Unset && binary(probdoor, rs))) ? 1 : 0));
+                      ((rdoor[0] == Open || (rdoor[0] == Unset && binary(probdoor, rs))) ? 1 : 0));
             if (!done_s)
               setdoor(maze->doorvector, size, coord[0], coord[1], coord[2], 2,
-                      ((rstate->door[2] == Open || (rstate->door[2] == Unset && binary(probdoor, rs))) ? 1 : 0));
-            up = ((rstate->door[4*(params->keys+params->levers+1)] == Open || (rstate->door[4*(params->keys+params->levers+1)] == Unset && binary(probdoor, rs))) ? 1 : 0);
-            down = ((rstate->door[4*(params->keys+params->levers+1)+1] == Open || (rstate->door[4*(params->keys+params->levers+1)+1] == Unset && states[ind-size*size]->door[4*(params->keys+params->levers+1)] == Open)) ? 1 : 0);
+                      ((rdoor[2] == Open || (rdoor[2] == Unset && binary(probdoor, rs))) ? 1 : 0));
+            up = ((rdoor[4*(params->keys+params->levers+1)] == Open || (rdoor[4*(params->keys+params->levers+1)] == Unset && binary(probdoor, rs))) ? 1 : 0);
+            down = ((rdoor[4*(params->keys+params->levers+1)+1] == Open || (rdoor[4*(params->keys+params->levers+1)+1] == Unset && g->door[(ind-size*size)*g->ndoors + 4*(params->keys+params->levers+1)] == Open)) ? 1 : 0);
             if (up || down)
               maze->roomvector[k] = up + 2*down;
             else {
               rp = 0;
               for (i=0; i<(params->keys+params->levers); i++)
-                if (rstate->door[4*(params->keys+params->levers+1)+2+i] == Open)
+                if (rdoor[4*(params->keys+params->levers+1)+2+i] == Open)
                   rp = 4+i;
               maze->roomvector[k] = rp;
             }
@@ -2164,26 +2227,24 @@ static SuperMaze* makesupermaze(SmPowerRoom** states, const game_params *params,
   return maze;
 }
 
-static int countsolutionstates(SmPowerRoom** states, const game_params *params, char** aux)
+static int countsolutionstates(SmPowerGraph* g, const game_params *params, char** aux)
 {
   int par, ok, solcount;
   int i, j;
   char* p;
   char* tmpaux;
   char last, curr;
-  int ndoors, npool;
-  int num = numindex(params);
-  SmPowerRoom** pool = snewn(num, SmPowerRoom*);
-  SmPowerRoom* rstate;
-  ndoors = numdoors(params);
-  for (i=0; i<num; i++)
-    states[i]->dist = -1;
+  int r, npool;
+  int ndoors = g->ndoors;
+  int num = g->num;
+  int* pool = snewn(num, int);
+  cleardistance(g);
   npool = (params->style == Keys ? 1<<params->keys : params->style == Levers ? 1<<params->levers : params->style == Combo ? 1<<(params->keys + params->levers) : 1);
   for (i=0; i<npool; i++) {
-    pool[i] = states[num-npool+i];
+    pool[i] = num-npool+i;
   }
-  calcdistance(pool, npool, ndoors);
-  solcount = states[0]->dist;
+  calcdistance(g, pool, npool, ndoors);
+  solcount = g->dist[0];
   if (solcount == -1) {
     *aux = 0;
     return -1;
@@ -2192,15 +2253,15 @@ static int countsolutionstates(SmPowerRoom** states, const game_params *params,
   tmpaux = p = snewn(solcount*2+2, char);
   *p++ = 'S';
 
-  rstate = states[0];
+  r = 0;
   par = 0;
   last = 'A';
   *p++ = last;
-  while (rstate->dist != 0) {
+  while (g->dist[r] != 0) {
     ok = 0;
     for (j=0; j<ndoors; j++)
-      if (rstate->door[j] == Open && rstate->trans[j]->dist == rstate->dist - 1) {
-        pool[npool++] = rstate;
+      if (g->door[r*ndoors + j] == Open && g->dist[g->trans[r*ndoors + j]] == g->dist[r] - 1) {
+        pool[npool++] = r;
         if (params->style == Basic) {
           *p++ = (j == 0 ? 'e' : j == 1 ? 'w' : j == 2 ? 's' : 'n');
         } else if (params->style == Tandem) {
@@ -2208,7 +2269,7 @@ static int countsolutionstates(SmPowerRoom** states, const game_params *params,
           if (last != curr)
             *p++ = last = curr;
           *p++ = ((j&3) == 0 ? 'e' : (j&3) == 1 ? 'w' : (j&3) == 2 ? 's' : 'n');
-          par = (((rstate->recdir[j]^j)&4) ? !par : par);
+          par = (((g->recdir[r*ndoors + j]^j)&4) ? !par : par);
         } else if (params->style == ThreeD) {
           *p++ = (j == 0 ? 'e' : j == 1 ? 'w' : j == 2 ? 's' : j == 3 ? 'n' : j == 4 ? 'u' : 'd');
         } else if (params->style == Floors) {
@@ -2223,7 +2284,7 @@ static int countsolutionstates(SmPowerRoom** states, const game_params *params,
                   j == 4*(params->keys+params->levers+1) + 1 ? 'd' :
                   (j&3) == 0 ? 'e' : (j&3) == 1 ? 'w' : (j&3) == 2 ? 's' : 'n');
         } 
-        rstate = rstate->trans[j];
+        r = g->trans[r*ndoors + j];
         ok = 1;
         break;
       }
@@ -2239,10 +2300,10 @@ static int countsolutionstates(SmPowerRoom** states, const game_params *params,
   *aux = p = snewn(num+2, char);
   *p++ = 'S';
   for (i=0; i<num; i++) {
-    rstate = states[i];
+    r = i;
     ok = 0;
     for (j=0; j<ndoors; j++)
-      if (rstate->door[j] == Open && rstate->trans[j]->dist == rstate->dist - 1) {
+      if (g->door[r*ndoors + j] == Open && g->dist[g->trans[r*ndoors + j]] == g->dist[r] - 1) {
         if (params->style == Basic) {
           *p++ = (j == 0 ? 'e' : j == 1 ? 'w' : j == 2 ? 's' : 'n');
         } else if (params->style == Tandem) {
@@ -2272,9 +2333,8 @@ static int countsolutionstates(SmPowerRoom** states, const game_params *params,
   }
   *p = 0;
 
-  for (i=0; i<num; i++)
-    states[i]->dist = -1;
-  calcdistance(pool, npool, ndoors);
+  cleardistance(g);
+  calcdistance(g, pool, npool, ndoors);
   /* printf("Steps: %d  Longest: %d   Sol: %s\n", solcount, max, tmpaux+1); */
   sfree(tmpaux);
 
@@ -2365,7 +2425,7 @@ static char *new_game_desc(const game_params *params, random_state *rs,
   char *buf = 0, *p;
   int i, sz, hexlen, nfloors, nrooms, nswitches, dprop, solcount;
   SuperMaze* maze;
-  SmPowerRoom** states;
+  SmPowerGraph* states;
   do {
     states = makepowerstates(params, rs);
   } while (!states);
@@ -2391,7 +2451,7 @@ static char *new_game_desc(const game_params *params, random_state *rs,
   }
   *p = '\0';
 
-  free_powerstates(states, params);
+  free_powerstates(states);
   free_supermaze(maze);
   return buf;
 }